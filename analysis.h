@@ -0,0 +1,48 @@
+/* 
+ * MDFourier
+ * A Fourier Transform analysis tool to compare game console audio
+ * http://junkerhq.net/MDFourier/
+ *
+ * Copyright (C)2019-2020 Artemio Urbina
+ *
+ * This file is part of the 240p Test Suite
+ *
+ * You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA	02111-1307	USA
+ *
+ * Requires the FFTW library: 
+ *	  http://www.fftw.org/
+ * 
+ */
+
+#ifndef MDFOURIER_ANALYSIS_H
+#define MDFOURIER_ANALYSIS_H
+
+#include "mdfourier.h"
+
+int ProcessPair(AudioSignal **ReferenceSignal, AudioSignal **ComparisonSignal, parameters *config);
+int ProcessReference(parameters *config);
+int RunComparisonBatch(parameters *config);
+int RunBatchPair(int index, ComparisonJob *job, int logging, parameters *base, parameters *config);
+void RestorePairParameters(parameters *config, parameters *base);
+int RunComparisonMatrix(parameters *config);
+void CleanUp(AudioSignal **ReferenceSignal, AudioSignal **ComparisonSignal, parameters *config);
+void PrintElapsedTime(struct timespec *start);
+void PrintJSONString(FILE *file, char *text);
+
+// Kernels, also timed by mdbench
+int ExecuteDFFTInternal(AudioBlocks *AudioArray, int16_t *samples, size_t size, long samplerate, double *window, float *windowFloat, char channel, int AudioChannels, int ZeroPad, parameters *config);
+int CompareFrequencies(AudioSignal *ReferenceSignal, AudioSignal *ComparisonSignal, char channel, int block, int refSize, int testSize, parameters *config);
+
+#endif
@@ -30,8 +30,12 @@
 #include "balance.h"
 #include "freq.h"
 #include "windows.h"
+#include "mixdown.h"
+#include "plans.h"
 #include "log.h"
 #include "cline.h"
+#include "loadfile.h"
+#include "trace.h"
 
 int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 {
@@ -42,7 +46,7 @@ int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 	windowManager	windows;
 	double			*windowUsed = NULL;
 	long int		loadedBlockSize = 0, i = 0, matchIndex = 0;
-	struct timespec	start, end;
+	TraceSpan	span;
 	int				leftover = 0, discardBytes = 0;
 	double			leftDecimals = 0, MaxMagLeft = 0, MaxMagRight = 0;
 	AudioBlocks		Channels[2];
@@ -88,8 +92,7 @@ int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 	if(!initWindows(&windows, Signal->header.fmt.SamplesPerSec, 'f', config))
 		return 0;
 
-	if(config->clock)
-		clock_gettime(CLOCK_MONOTONIC, &start);
+	TraceBegin(&span, "Audio Channel Balancing", "balance", config);
 
 	while(i <= block)
 	{
@@ -123,18 +126,30 @@ int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 				break;
 			}
 			
+			if(!RequestSamples(Signal, pos, pos + loadedBlockSize))
+			{
+				TraceEnd(&span, config);
+				return 0;
+			}
 			memcpy(buffer, Signal->Samples + pos, loadedBlockSize-difference);
 	
 			if(!ExecuteBalanceDFFT(&Channels[0], (int16_t*)buffer, (loadedBlockSize-difference)/2, Signal->header.fmt.SamplesPerSec, windowUsed, CHANNEL_LEFT, config))
+			{
+				TraceEnd(&span, config);
 				return 0;
+			}
 
 			if(!ExecuteBalanceDFFT(&Channels[1], (int16_t*)buffer, (loadedBlockSize-difference)/2, Signal->header.fmt.SamplesPerSec, windowUsed, CHANNEL_RIGHT, config))
+			{
+				TraceEnd(&span, config);
 				return 0;
+			}
 
 			Channels[0].freq = (Frequency*)malloc(sizeof(Frequency)*config->MaxFreq);
 			if(!Channels[0].freq)
 			{
 				logmsg("ERROR: Not enough memory for Data Structures\n");
+				TraceEnd(&span, config);
 				return 0;
 			}
 			memset(Channels[0].freq, 0, sizeof(Frequency)*config->MaxFreq);
@@ -144,6 +159,7 @@ int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 			{
 				ReleaseBlock(&Channels[0]);
 				logmsg("ERROR: Not enough memory for Data Structures\n");
+				TraceEnd(&span, config);
 				return 0;
 			}
 			memset(Channels[1].freq, 0, sizeof(Frequency)*config->MaxFreq);
@@ -153,6 +169,7 @@ int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 				ReleaseBlock(&Channels[1]);
 		
 				logmsg("- Could not detect Stereo channel balance.\n");
+				TraceEnd(&span, config);
 				return 0;
 			}
 			if(!FillFrequencyStructures(Signal, &Channels[1], config))
@@ -161,6 +178,7 @@ int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 				ReleaseBlock(&Channels[1]);
 		
 				logmsg("- Could not detect Stereo channel balance.\n");
+				TraceEnd(&span, config);
 				return 0;
 			}
 		}
@@ -176,6 +194,7 @@ int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 		ReleaseBlock(&Channels[1]);
 
 		logmsg("- Could not detect Stereo channel balance.\n");
+		TraceEnd(&span, config);
 		return 0;
 	}
 
@@ -202,6 +221,7 @@ int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 
 		config->noBalance |= Signal->role;
 
+		TraceEnd(&span, config);
 		return 0;
 	}
 
@@ -272,19 +292,23 @@ int CheckBalance(AudioSignal *Signal, int block, parameters *config)
 			Signal->balance *= -1;
 		
 		if(config->channelBalance)
-			BalanceAudioChannel(Signal, diffNam, ratio);
+		{
+			/* Mapped samples are left as they are, blocks get it as they are copied */
+			if(Signal->SamplesMap)
+			{
+				Signal->balanceChannel = diffNam;
+				Signal->balanceRatio = ratio;
+				Signal->balancePos = Signal->startOffset;
+			}
+			else
+				BalanceAudioChannel(Signal, diffNam, ratio);
+		}
 	}
 	else
 		logmsg(" - %s signal has no stereo imbalance\n",
 			Signal->role == ROLE_REF ? "Reference" : "Comparison");
 
-	if(config->clock)
-	{
-		double	elapsedSeconds;
-		clock_gettime(CLOCK_MONOTONIC, &end);
-		elapsedSeconds = TimeSpecToSeconds(&end) - TimeSpecToSeconds(&start);
-		logmsg(" - clk: Audio Channel Balancing took %0.2fs\n", elapsedSeconds);
-	}
+	TraceEndStage(&span, config);
 
 	ReleaseBlock(&Channels[0]);
 	ReleaseBlock(&Channels[1]);
@@ -299,7 +323,7 @@ int ExecuteBalanceDFFT(AudioBlocks *AudioArray, int16_t *samples, size_t size, l
 {
 	fftw_plan		p = NULL;
 	long		  	stereoSignalSize = 0;	
-	long		  	i = 0, monoSignalSize = 0, zeropadding = 0;
+	long		  	monoSignalSize = 0, zeropadding = 0;
 	double		  	*signal = NULL;
 	fftw_complex  	*spectrum = NULL;
 	double		 	seconds = 0;
@@ -317,7 +341,7 @@ int ExecuteBalanceDFFT(AudioBlocks *AudioArray, int16_t *samples, size_t size, l
 	if(config->ZeroPad)  /* disabled by default */
 		zeropadding = GetZeroPadValues(&monoSignalSize, &seconds, samplerate);
 
-	signal = (double*)malloc(sizeof(double)*(monoSignalSize+1));
+	signal = (double*)fftw_malloc(sizeof(double)*(monoSignalSize+1));
 	if(!signal)
 	{
 		logmsg("Not enough memory\n");
@@ -327,49 +351,28 @@ int ExecuteBalanceDFFT(AudioBlocks *AudioArray, int16_t *samples, size_t size, l
 	if(!spectrum)
 	{
 		logmsg("Not enough memory\n");
+		fftw_free(signal);
 		return(0);
 	}
 
-	if(!config->model_plan)
-	{
-		config->model_plan = fftw_plan_dft_r2c_1d(monoSignalSize, signal, spectrum, FFTW_MEASURE);
-		if(!config->model_plan)
-		{
-			logmsg("FFTW failed to create FFTW_MEASURE plan\n");
-			free(signal);
-			signal = NULL;
-			return 0;
-		}
-	}
-
-	p = fftw_plan_dft_r2c_1d(monoSignalSize, signal, spectrum, FFTW_MEASURE);
+	p = getForwardPlan(&config->plans, monoSignalSize, signal, spectrum);
 	if(!p)
 	{
 		logmsg("FFTW failed to create FFTW_MEASURE plan\n");
-		free(signal);
-		signal = NULL;
+		fftw_free(signal);
+		fftw_free(spectrum);
 		return 0;
 	}
 
 	memset(signal, 0, sizeof(double)*(monoSignalSize+1));
 	memset(spectrum, 0, sizeof(fftw_complex)*(monoSignalSize/2+1));
 
-	for(i = 0; i < monoSignalSize - zeropadding; i++)
-	{
-		if(channel == CHANNEL_LEFT)
-			signal[i] = (double)samples[i*2];
-		if(channel == CHANNEL_RIGHT)
-			signal[i] = (double)samples[i*2+1];
-
-		if(window)
-			signal[i] *= window[i];
-	}
+	MixdownToDouble(signal, samples, monoSignalSize - zeropadding, window, channel, 2);
 
-	fftw_execute(p); 
-	fftw_destroy_plan(p);
+	fftw_execute_dft_r2c(p, signal, spectrum);
 	p = NULL;
 
-	free(signal);
+	fftw_free(signal);
 	signal = NULL;
 
 	AudioArray->fftwValues.spectrum = spectrum;
@@ -380,6 +383,107 @@ int ExecuteBalanceDFFT(AudioBlocks *AudioArray, int16_t *samples, size_t size, l
 }
 
 void BalanceAudioChannel(AudioSignal *Signal, char channel, double ratio)
+{
+	if(!Signal)
+		return;
+
+	BalanceAudioChannelRange(Signal, channel, ratio, Signal->startOffset, Signal->endOffset);
+}
+
+/*
+	Applies the balance left pending by CheckBalance and then the time
+	domain normalization, in place up to the byte position given
+*/
+void ApplyDeferredBalance(AudioSignal *Signal, long int upTo)
+{
+	if(!Signal || (Signal->balanceChannel == CHANNEL_NONE && !Signal->normalizeRatio))
+		return;
+
+	if(upTo > Signal->endOffset)
+		upTo = Signal->endOffset;
+	if(upTo <= Signal->balancePos)
+		return;
+
+	if(Signal->balanceChannel != CHANNEL_NONE)
+		BalanceAudioChannelRange(Signal, Signal->balanceChannel, Signal->balanceRatio, Signal->balancePos, upTo);
+	if(Signal->normalizeRatio)
+		NormalizeAudioRange(Signal, Signal->normalizeRatio, Signal->balancePos, upTo);
+	Signal->balancePos = upTo;
+	if(Signal->balancePos >= Signal->endOffset)
+	{
+		Signal->balanceChannel = CHANNEL_NONE;
+		Signal->normalizeRatio = 0;
+	}
+}
+
+void NormalizeAudioRange(AudioSignal *Signal, double ratio, long int startByte, long int endByte)
+{
+	long int 	i = 0, start = 0, end = 0;
+	int16_t		*samples = NULL;
+
+	if(!Signal || !Signal->Samples)
+		return;
+
+	samples = (int16_t*)Signal->Samples;
+	start = (startByte > Signal->startOffset ? startByte : Signal->startOffset)/2;
+	end = endByte/2;
+
+	// improvement suggested by plgDavid
+	for(i = start; i < end; i++)
+		samples[i] = (int16_t)((((double)samples[i])*ratio)+0.5);
+}
+
+/*
+	Copies bytes from pos into dest with the balance and normalization
+	still pending applied to the copy, changes the same samples and in the
+	same order as ApplyDeferredBalance would have in place
+*/
+void CopyBalancedSamples(AudioSignal *Signal, char *dest, long int pos, long int bytes)
+{
+	long int 	i = 0, start = 0, end = 0, first = 0, last = 0, side = 0;
+	int16_t		*samples = NULL;
+	double		ratio = 0;
+
+	memcpy(dest, Signal->Samples + pos, bytes);
+	if(Signal->balanceChannel == CHANNEL_NONE && !Signal->normalizeRatio)
+		return;
+
+	samples = (int16_t*)dest;
+	first = pos/2;
+	last = (pos + bytes)/2;
+
+	if(Signal->balanceChannel != CHANNEL_NONE)
+	{
+		ratio = Signal->balanceRatio;
+		side = Signal->balanceChannel == CHANNEL_RIGHT ? 1 : 0;
+
+		start = Signal->startOffset/2;
+		end = Signal->endOffset/2;
+		if(Signal->balancePos > Signal->startOffset)
+			start += ((Signal->balancePos - Signal->startOffset)/2 + 1)/2*2;
+		if(start + side < first)
+			start += (first - start - side + 1)/2*2;
+
+		for(i = start; i < end && i + side < last; i+=2)
+			samples[i + side - first] = (int16_t)((double)samples[i + side - first])*ratio;
+	}
+
+	if(Signal->normalizeRatio)
+	{
+		ratio = Signal->normalizeRatio;
+		start = (Signal->balancePos > Signal->startOffset ? Signal->balancePos : Signal->startOffset)/2;
+		end = Signal->endOffset/2;
+		if(start < first)
+			start = first;
+		if(end > last)
+			end = last;
+
+		for(i = start; i < end; i++)
+			samples[i - first] = (int16_t)((((double)samples[i - first])*ratio)+0.5);
+	}
+}
+
+void BalanceAudioChannelRange(AudioSignal *Signal, char channel, double ratio, long int startByte, long int endByte)
 {
 	long int 	i = 0, start = 0, end = 0;
 	int16_t		*samples = NULL;
@@ -392,7 +496,11 @@ void BalanceAudioChannel(AudioSignal *Signal, char channel, double ratio)
 
 	samples = (int16_t*)Signal->Samples;
 	start = Signal->startOffset/2;
-	end = Signal->endOffset/2;
+	end = endByte/2;
+
+	/* keep the stereo pairs as they were when starting at startOffset */
+	if(startByte > Signal->startOffset)
+		start += ((startByte - Signal->startOffset)/2 + 1)/2*2;
 
 	for(i = start; i < end; i+=2)
 	{
@@ -32,5 +32,9 @@
 int CheckBalance(AudioSignal *Signal, int block, parameters *config);
 int ExecuteBalanceDFFT(AudioBlocks *AudioArray, int16_t *samples, size_t size, long samplerate, double *window, char channel, parameters *config);
 void BalanceAudioChannel(AudioSignal *Signal, char channel, double ratio);
+void BalanceAudioChannelRange(AudioSignal *Signal, char channel, double ratio, long int startByte, long int endByte);
+void ApplyDeferredBalance(AudioSignal *Signal, long int upTo);
+void CopyBalancedSamples(AudioSignal *Signal, char *dest, long int pos, long int bytes);
+void NormalizeAudioRange(AudioSignal *Signal, double ratio, long int startByte, long int endByte);
 
 #endif
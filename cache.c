@@ -0,0 +1,544 @@
+/* 
+ * MDFourier
+ * A Fourier Transform analysis tool to compare game console audio
+ * http://junkerhq.net/MDFourier/
+ *
+ * Copyright (C)2019-2020 Artemio Urbina
+ *
+ * This file is part of the 240p Test Suite
+ *
+ * You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA	02111-1307	USA
+ *
+ * Requires the FFTW library: 
+ *	  http://www.fftw.org/
+ * 
+ */
+
+#include "mdfourier.h"
+#include "log.h"
+#include "cline.h"
+#include "freq.h"
+#include "cache.h"
+
+#if !defined (WIN32)
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+/*
+	The Reference analysis (sync, frame rate, balance and the per block 
+	frequencies before normalization) only depends on the file, the profile
+	and the FFT options, so it can be kept on disk for the next run against
+	another Comparison. Anything that needs the Comparison or changes the
+	Reference samples afterwards is left out.
+*/
+int ReferenceReusable(parameters *config)
+{
+	if(config->noSyncProfile || config->normType == max_time ||
+		config->doClkAdjust || config->plotAllNotesWindowed)
+		return 0;
+	return 1;
+}
+
+int ReferenceCacheEnabled(parameters *config)
+{
+	if(!config->cacheFolder[0])
+		return 0;
+	return(ReferenceReusable(config));
+}
+
+int GetReferenceFlags(parameters *config)
+{
+	int flags = 0;
+
+	if(config->smallFile & ROLE_REF)
+		flags |= CACHE_SMALLFILE;
+	if(config->stereoNotFound & ROLE_REF)
+		flags |= CACHE_STEREONOTFOUND;
+	if(config->internalSyncTolerance & ROLE_REF)
+		flags |= CACHE_INTERNALSYNC;
+	if(config->SRNoMatch & ROLE_REF)
+		flags |= CACHE_SRNOMATCH;
+	return flags;
+}
+
+void SetReferenceFlags(int flags, double centsDifferenceSR, parameters *config)
+{
+	if(flags & CACHE_SMALLFILE)
+		SetRoleFlag(&config->smallFile, ROLE_REF);
+	if(flags & CACHE_STEREONOTFOUND)
+		SetRoleFlag(&config->stereoNotFound, ROLE_REF);
+	if(flags & CACHE_INTERNALSYNC)
+		SetRoleFlag(&config->internalSyncTolerance, ROLE_REF);
+	if(flags & CACHE_SRNOMATCH)
+	{
+		SetRoleFlag(&config->SRNoMatch, ROLE_REF);
+		config->RefCentsDifferenceSR = centsDifferenceSR;
+	}
+}
+
+void HashBytes(uint64_t *hash, void *data, size_t size)
+{
+	unsigned char *bytes = (unsigned char*)data;
+
+	for(size_t i = 0; i < size; i++)
+	{
+		*hash ^= bytes[i];
+		*hash *= FNV_PRIME;
+	}
+}
+
+int HashFile(char *fileName, uint64_t *hash)
+{
+	FILE			*file = NULL;
+	unsigned char	buffer[65536];
+	size_t			read = 0;
+
+	file = fopen(fileName, "rb");
+	if(!file)
+		return 0;
+
+	while((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		HashBytes(hash, buffer, read);
+
+	if(ferror(file))
+	{
+		fclose(file);
+		return 0;
+	}
+	fclose(file);
+	return 1;
+}
+
+#define HashValue(hash, value) HashBytes(hash, &(value), sizeof(value))
+
+int CreateCacheKey(uint64_t *key, parameters *config)
+{
+	*key = FNV_OFFSET;
+
+	HashBytes(key, MDVERSION, strlen(MDVERSION));
+	if(!HashFile(config->referenceFile, key))
+		return 0;
+	if(!HashFile(config->profileFile, key))
+		return 0;
+
+	HashValue(key, config->window);
+	HashValue(key, config->MaxFreq);
+	HashValue(key, config->startHz);
+	HashValue(key, config->endHz);
+	HashValue(key, config->ZeroPad);
+	HashValue(key, config->floatFFT);
+	HashValue(key, config->normType);
+	HashValue(key, config->channelBalance);
+	HashValue(key, config->stereoBalanceBlock);
+	HashValue(key, config->syncTolerance);
+	HashValue(key, config->videoFormatRef);
+	HashValue(key, config->doSamplerateAdjust);
+	HashValue(key, config->ignoreFrameRateDiff);
+	HashValue(key, config->allowStereoVsMono);
+	HashValue(key, config->useExtraData);
+	HashValue(key, config->plotAllNotes);
+	HashValue(key, config->plotTimeDomainHiDiff);
+	HashValue(key, config->debugSync);
+	return 1;
+}
+
+/* A single mapping for the whole file, the arrays are copied out of it */
+static char *MapCacheFile(char *fileName, size_t *size)
+{
+	char	*data = NULL;
+#if !defined (WIN32)
+	int			fd = -1;
+	struct stat	fileStat;
+
+	fd = open(fileName, O_RDONLY);
+	if(fd == -1)
+		return NULL;
+	if(fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(CacheHeader))
+	{
+		close(fd);
+		return NULL;
+	}
+	*size = fileStat.st_size;
+	data = (char*)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+		return NULL;
+#else
+	FILE	*file = NULL;
+	long	length = 0;
+
+	file = fopen(fileName, "rb");
+	if(!file)
+		return NULL;
+	if(fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < (long)sizeof(CacheHeader))
+	{
+		fclose(file);
+		return NULL;
+	}
+	rewind(file);
+	*size = length;
+	data = (char*)malloc(*size);
+	if(data && fread(data, 1, *size, file) != *size)
+	{
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+#endif
+	return data;
+}
+
+static void UnmapCacheFile(char *data, size_t size)
+{
+#if !defined (WIN32)
+	munmap(data, size);
+#else
+	free(data);
+#endif
+}
+
+static int ReadCache(char **pos, char *end, void *dest, size_t size)
+{
+	if((size_t)(end - *pos) < size)
+		return 0;
+	memcpy(dest, *pos, size);
+	*pos += size;
+	return 1;
+}
+
+static int ReadCacheSamples(BlockSamples *dest, BlockSamples *saved, char **pos, char *end)
+{
+	size_t	bytes = 0;
+
+	dest->samples = NULL;
+	dest->window_samples = NULL;
+	dest->size = 0;
+	dest->difference = saved->difference;
+
+	if(saved->size < 0)
+		return 0;
+	bytes = sizeof(int16_t)*(saved->size+1);
+	if(saved->samples)
+	{
+		dest->samples = (int16_t*)malloc(bytes);
+		if(!dest->samples || !ReadCache(pos, end, dest->samples, bytes))
+			return 0;
+	}
+	if(saved->window_samples)
+	{
+		dest->window_samples = (int16_t*)malloc(bytes);
+		if(!dest->window_samples || !ReadCache(pos, end, dest->window_samples, bytes))
+			return 0;
+	}
+	dest->size = saved->size;
+	return 1;
+}
+
+/* Frequency arrays go into the ones CreateAudioSignal allocated */
+static int ReadCacheBlock(AudioBlocks *block, char **pos, char *end, parameters *config)
+{
+	AudioBlocks	saved;
+	Frequency	*freq = NULL, *freqRight = NULL;
+
+	if(!ReadCache(pos, end, &saved, sizeof(AudioBlocks)))
+		return 0;
+	if((saved.freq != NULL) != (block->freq != NULL) ||
+		(saved.freqRight != NULL) != (block->freqRight != NULL))
+		return 0;
+
+	freq = block->freq;
+	freqRight = block->freqRight;
+	*block = saved;
+	block->freq = freq;
+	block->freqRight = freqRight;
+	block->fftwValues.spectrum = NULL;
+	block->fftwValues.spectrumFloat = NULL;
+	block->fftwValuesRight.spectrum = NULL;
+	block->fftwValuesRight.spectrumFloat = NULL;
+	memset(&block->audio, 0, sizeof(BlockSamples));
+	memset(&block->audioRight, 0, sizeof(BlockSamples));
+	block->internalSync = NULL;
+	block->internalSyncCount = 0;
+
+	if(freq && !ReadCache(pos, end, freq, sizeof(Frequency)*config->MaxFreq))
+		return 0;
+	if(freqRight && !ReadCache(pos, end, freqRight, sizeof(Frequency)*config->MaxFreq))
+		return 0;
+
+	if(!ReadCacheSamples(&block->audio, &saved.audio, pos, end))
+		return 0;
+	if(!ReadCacheSamples(&block->audioRight, &saved.audioRight, pos, end))
+		return 0;
+
+	if(saved.internalSync && saved.internalSyncCount > 0)
+	{
+		if(!initInternalSync(block, saved.internalSyncCount))
+			return 0;
+		for(int i = 0; i < saved.internalSyncCount; i++)
+		{
+			BlockSamples	savedSync;
+
+			if(!ReadCache(pos, end, &savedSync, sizeof(BlockSamples)))
+				return 0;
+			if(!ReadCacheSamples(&block->internalSync[i], &savedSync, pos, end))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static int ReadCacheSignal(AudioSignal *Signal, char **pos, char *end, parameters *config)
+{
+	AudioSignal	saved;
+	AudioBlocks	*blocks = NULL, clkFrequencies;
+
+	if(!ReadCache(pos, end, &saved, sizeof(AudioSignal)))
+		return 0;
+
+	blocks = Signal->Blocks;
+	clkFrequencies = Signal->clkFrequencies;
+	*Signal = saved;
+	Signal->Blocks = blocks;
+	Signal->clkFrequencies = clkFrequencies;
+	Signal->Samples = NULL;
+	Signal->SamplesMap = NULL;
+	Signal->SamplesMapSize = 0;
+	Signal->lazyFLAC = NULL;
+	Signal->role = ROLE_REF;
+	sprintf(Signal->SourceFile, "%s", config->referenceFile);
+
+	if(config->clkMeasure && !ReadCacheBlock(&Signal->clkFrequencies, pos, end, config))
+		return 0;
+	for(int n = 0; n < config->types.totalBlocks; n++)
+	{
+		if(!ReadCacheBlock(&Signal->Blocks[n], pos, end, config))
+			return 0;
+	}
+	return 1;
+}
+
+static int CheckCacheHeader(CacheHeader *header, uint64_t key, parameters *config)
+{
+	if(memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0)
+		return 0;
+	if(header->version != CACHE_VERSION ||
+		header->signalSize != sizeof(AudioSignal) ||
+		header->blockSize != sizeof(AudioBlocks) ||
+		header->frequencySize != sizeof(Frequency))
+		return 0;
+	if(header->key != key || header->totalBlocks != config->types.totalBlocks ||
+		header->MaxFreq != config->MaxFreq)
+		return 0;
+	return 1;
+}
+
+/*
+	Returns 1 with the processed Reference in Signal. Any miss or invalid
+	file leaves Signal as NULL and the Reference is loaded as usual.
+*/
+int LoadReferenceCache(AudioSignal **Signal, parameters *config)
+{
+	CacheHeader	header;
+	uint64_t	key = 0;
+	char		*data = NULL, *pos = NULL;
+	size_t		size = 0;
+
+	*Signal = NULL;
+	config->referenceCached = 0;
+	if(!CreateCacheKey(&key, config))
+	{
+		logmsg(" - WARNING: Could not hash files for the analysis cache\n");
+		return 0;
+	}
+	config->cacheKey = key;
+	sprintf(config->cacheFile, "%s/%016llx.%s", config->cacheFolder, (unsigned long long)key, CACHE_EXTENSION);
+
+	data = MapCacheFile(config->cacheFile, &size);
+	if(!data)
+		return 0;
+
+	pos = data;
+	if(!ReadCache(&pos, data + size, &header, sizeof(CacheHeader)) ||
+		!CheckCacheHeader(&header, key, config))
+	{
+		UnmapCacheFile(data, size);
+		logmsg(" - WARNING: Ignoring invalid analysis cache %s\n", config->cacheFile);
+		return 0;
+	}
+
+	*Signal = CreateAudioSignal(config);
+	if(!*Signal || !ReadCacheSignal(*Signal, &pos, data + size, config))
+	{
+		UnmapCacheFile(data, size);
+		if(*Signal)
+		{
+			ReleaseAudio(*Signal, config);
+			free(*Signal);
+			*Signal = NULL;
+		}
+		logmsg(" - WARNING: Ignoring invalid analysis cache %s\n", config->cacheFile);
+		return 0;
+	}
+	UnmapCacheFile(data, size);
+
+	SetReferenceFlags(header.flags, header.RefCentsDifferenceSR, config);
+	config->cachedFramerate = header.smallerFramerate;
+	config->referenceCached = 1;
+	return 1;
+}
+
+static int WriteCache(FILE *file, void *data, size_t size)
+{
+	return(fwrite(data, 1, size, file) == size);
+}
+
+static int WriteCacheSamples(FILE *file, BlockSamples *samples)
+{
+	size_t	bytes = sizeof(int16_t)*(samples->size+1);
+
+	if(samples->samples && !WriteCache(file, samples->samples, bytes))
+		return 0;
+	if(samples->window_samples && !WriteCache(file, samples->window_samples, bytes))
+		return 0;
+	return 1;
+}
+
+static int WriteCacheBlock(FILE *file, AudioBlocks *block, parameters *config)
+{
+	if(!WriteCache(file, block, sizeof(AudioBlocks)))
+		return 0;
+	if(block->freq && !WriteCache(file, block->freq, sizeof(Frequency)*config->MaxFreq))
+		return 0;
+	if(block->freqRight && !WriteCache(file, block->freqRight, sizeof(Frequency)*config->MaxFreq))
+		return 0;
+	if(!WriteCacheSamples(file, &block->audio) || !WriteCacheSamples(file, &block->audioRight))
+		return 0;
+
+	if(block->internalSync)
+	{
+		for(int i = 0; i < block->internalSyncCount; i++)
+		{
+			if(!WriteCache(file, &block->internalSync[i], sizeof(BlockSamples)))
+				return 0;
+			if(!WriteCacheSamples(file, &block->internalSync[i]))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static int WriteCacheFile(FILE *file, AudioSignal *Signal, parameters *config)
+{
+	if(!WriteCache(file, Signal, sizeof(AudioSignal)))
+		return 0;
+	if(config->clkMeasure && !WriteCacheBlock(file, &Signal->clkFrequencies, config))
+		return 0;
+	for(int n = 0; n < config->types.totalBlocks; n++)
+	{
+		if(!WriteCacheBlock(file, &Signal->Blocks[n], config))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+	Called right after the FFTs, before normalization touches the values.
+	Written under a temporary name and renamed, so runs sharing the folder
+	never see a partial file. The name is unique per call, engines in the
+	same process can be caching the same reference at once.
+*/
+int SaveReferenceCache(AudioSignal *Signal, parameters *config)
+{
+	CacheHeader	header;
+	FILE		*file = NULL;
+	char		tempFile[BUFFER_SIZE*2+32];
+#if !defined (WIN32)
+	int			fd = -1;
+#else
+	static long	tempCount = 0;
+#endif
+
+	if(!config->cacheFile[0] || config->referenceCached)
+		return 0;
+
+	if(!CreateFolder(config->cacheFolder))
+	{
+		logmsg(" - WARNING: Could not create analysis cache folder %s\n", config->cacheFolder);
+		return 0;
+	}
+
+	memset(&header, 0, sizeof(CacheHeader));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.signalSize = sizeof(AudioSignal);
+	header.blockSize = sizeof(AudioBlocks);
+	header.frequencySize = sizeof(Frequency);
+	header.key = config->cacheKey;
+	header.totalBlocks = config->types.totalBlocks;
+	header.MaxFreq = config->MaxFreq;
+	header.smallerFramerate = config->smallerFramerate;
+	header.flags = GetReferenceFlags(config);
+	if(header.flags & CACHE_SRNOMATCH)
+		header.RefCentsDifferenceSR = config->RefCentsDifferenceSR;
+
+#if !defined (WIN32)
+	sprintf(tempFile, "%s.XXXXXX", config->cacheFile);
+	fd = mkstemp(tempFile);
+	if(fd != -1)
+	{
+		fchmod(fd, 0644);  // mkstemp only lets the owner read it
+		file = fdopen(fd, "wb");
+		if(!file)
+		{
+			close(fd);
+			remove(tempFile);
+		}
+	}
+#else
+	sprintf(tempFile, "%s.%d.%ld.tmp", config->cacheFile, (int)getpid(), __sync_add_and_fetch(&tempCount, 1));
+	file = fopen(tempFile, "wb");
+#endif
+	if(!file)
+	{
+		logmsg(" - WARNING: Could not create analysis cache %s\n", tempFile);
+		return 0;
+	}
+	if(!WriteCache(file, &header, sizeof(CacheHeader)) || !WriteCacheFile(file, Signal, config))
+	{
+		fclose(file);
+		remove(tempFile);
+		logmsg(" - WARNING: Could not write analysis cache %s\n", config->cacheFile);
+		return 0;
+	}
+	if(fclose(file) != 0)
+	{
+		remove(tempFile);
+		return 0;
+	}
+#if defined (WIN32)
+	remove(config->cacheFile);
+#endif
+	if(rename(tempFile, config->cacheFile) != 0)
+	{
+		remove(tempFile);
+		logmsg(" - WARNING: Could not write analysis cache %s\n", config->cacheFile);
+		return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,69 @@
+/* 
+ * MDFourier
+ * A Fourier Transform analysis tool to compare game console audio
+ * http://junkerhq.net/MDFourier/
+ *
+ * Copyright (C)2019-2020 Artemio Urbina
+ *
+ * This file is part of the 240p Test Suite
+ *
+ * You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA	02111-1307	USA
+ *
+ * Requires the FFTW library: 
+ *	  http://www.fftw.org/
+ * 
+ */
+
+#ifndef MDFOURIER_CACHE_H
+#define MDFOURIER_CACHE_H
+
+#include "mdfourier.h"
+
+#define CACHE_MAGIC			"MDFCACHE"
+#define CACHE_VERSION		1
+#define CACHE_EXTENSION		"mdfc"
+
+/* Reference bits in config flags that are set while loading */
+#define CACHE_SMALLFILE		0x01
+#define CACHE_STEREONOTFOUND	0x02
+#define CACHE_INTERNALSYNC	0x04
+#define CACHE_SRNOMATCH		0x08
+
+/* Followed by the AudioSignal, its clock block and every block with its arrays */
+typedef struct cache_header_st {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	signalSize;
+	uint32_t	blockSize;
+	uint32_t	frequencySize;
+	uint64_t	key;
+	int32_t		totalBlocks;
+	int32_t		MaxFreq;
+	int32_t		flags;
+	double		smallerFramerate;
+	double		RefCentsDifferenceSR;
+} CacheHeader;
+
+int ReferenceReusable(parameters *config);
+int ReferenceCacheEnabled(parameters *config);
+int GetReferenceFlags(parameters *config);
+void SetReferenceFlags(int flags, double centsDifferenceSR, parameters *config);
+int LoadReferenceCache(AudioSignal **Signal, parameters *config);
+int SaveReferenceCache(AudioSignal *Signal, parameters *config);
+int CreateCacheKey(uint64_t *key, parameters *config);
+int HashFile(char *fileName, uint64_t *hash);
+void HashBytes(uint64_t *hash, void *data, size_t size);
+
+#endif
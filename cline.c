@@ -28,8 +28,11 @@
 
 #include "cline.h"
 #include "log.h"
+#include "plans.h"
+#include "threads.h"
 #include "plot.h"
 #include "profile.h"
+#include "trace.h"
 
 #define CHAR_FOLDER_REMOVE		0
 #define CHAR_FOLDER_OK			1
@@ -40,6 +43,8 @@
 void PrintUsage()
 {
 	logmsg("  usage: mdfourier -P profile.mdf -r reference.wav -c compare.wav\n");
+	logmsg("	 -c can be repeated or given as @list.txt to compare the Reference against each file\n");
+	logmsg("	 -2: Compare all files (-r and every -c) against each other, results go to Matrix.csv & .json\n");
 	logmsg("   FFT and Analysis options:\n");
 	logmsg("	 -w: enable <w>indowing. Default is a custom Tukey window.\n");
 	logmsg("		'n' none, 't' Tukey, 'h' Hann, 'f' FlatTop & 'm' Hamming\n");
@@ -55,16 +60,26 @@ void PrintUsage()
 	logmsg("	 -I: <I>gnore frame rate difference for analysis\n");
 	logmsg("	 -p: Define the noise floor value in dBFS (0 to disable auto adjust)\n");
 	logmsg("	 -T: Increase Sync detection <T>olerance (ignore frequency for pulses)\n");
+	logmsg("	 -q: <q>uick sync detection, coarse search and Goertzel filters\n");
 	logmsg("	 -Y: Define the Reference Video Format from the profile\n");
 	logmsg("	 -Z: Define the Comparison Video Format from the profile\n");
 	logmsg("	 -R: Adjust sample <R>ate if duration difference is found\n");
 	logmsg("	 -j: Ad<j>ust clock (profile defined) via FFTW if difference is found\n");
-	logmsg("	 -k: cloc<k> FFTW operations\n");
+	logmsg("	 -k: cloc<k> every stage, also saved as a Chrome trace (Trace.json)\n");
+	logmsg("	 -K: Number of threads to use, files, FLAC segments and FFTW blocks are processed in parallel\n");
+	logmsg("	 -m: Bounded <m>emory, blocks are processed as they are reached and released, FLAC is decoded on demand\n");
 	logmsg("	 -X: Do not use E<x>tra Data from the Profile\n");
+	logmsg("	 -J: Keep the Reference analysis in the given folder and reuse it in the next runs\n");
+	logmsg("	 -G: Use the <G>iven file to load and save FFTW wisdom\n");
+	logmsg("	 -1: FFTW planning level, saved as wisdom for the next runs:\n");
+	logmsg("		'm' Measure (default), 'p' Patient & 'x' Exhaustive\n");
+	logmsg("	 -4: Single precision FFTW, faster with less memory:\n");
+	logmsg("		'f' Float & 'v' Validate, runs both and reports the deviation\n");
 	logmsg("   Output options:\n");
 	logmsg("	 -l: Do not <l>og output to file [reference]_vs_[compare].txt\n");
 	logmsg("	 -v: Enable <v>erbose mode, spits all the FFTW results\n");
 	logmsg("	 -C: Create <C>SV file with plot values.\n");
+	logmsg("	 -3: Save Snapshot.txt with the frequencies and differences, see mdgolden\n");
 	logmsg("	 -b: Change <b>ar value for frequency match, default is 1.0dBFS.\n");
 	logmsg("	 -A: Do not weight values in <A>veraged Plot (implies -g)\n");
 	logmsg("	 -W: Use <W>hite background for plots.\n");
@@ -120,6 +135,10 @@ void CleanParameters(parameters *config)
 
 	sprintf(config->outputFolder, OUTPUT_FOLDER);
 	config->outputPath[0] = '\0';
+	config->workFolder[0] = '\0';
+	config->profileFile[0] = '\0';
+	config->referenceFile[0] = '\0';
+	config->comparisonFile[0] = '\0';
 
 	config->startHz = START_HZ;
 	config->endHz = END_HZ;
@@ -131,6 +150,7 @@ void CleanParameters(parameters *config)
 	config->window = 't';
 	config->MaxFreq = FREQ_COUNT;
 	config->clock = 0;
+	config->threads = 1;
 	config->showAll = 0;
 	config->ignoreFloor = 0;
 	config->useOutputFilter = 1;
@@ -141,6 +161,10 @@ void CleanParameters(parameters *config)
 	config->smallerFramerate = 0;
 	config->referenceFramerate = 0;
 	config->ZeroPad = 0;
+	config->floatFFT = FLOAT_FFT_OFF;
+	config->floatMaxDeviation = 0;
+	config->floatDeviationLevel = 0;
+	config->floatCompared = 0;
 	config->debugSync = 0;
 	config->drawWindows = 0;
 	config->channelBalance = 1;
@@ -148,11 +172,28 @@ void CleanParameters(parameters *config)
 	config->ignoreFrameRateDiff = 0;
 	config->labelNames = 1;
 	config->outputCSV = 0;
+	config->snapshot = 0;
 	config->whiteBG = 0;
 	config->smallFile = 0;
 	config->videoFormatRef = 0;
 	config->videoFormatCom = 0;
 	config->syncTolerance = 0;
+	config->quickSync = 0;
+	config->boundedMemory = 0;
+	config->cacheFolder[0] = '\0';
+	config->cacheFile[0] = '\0';
+	config->cacheKey = 0;
+	config->referenceCached = 0;
+	config->cachedFramerate = 0;
+	config->processedReference = NULL;
+	config->processedFramerate = 0;
+	config->referenceFlags = 0;
+	config->referenceCentsSR = 0;
+	config->preloadedComparison = NULL;
+	config->comparisonList = NULL;
+	config->comparisonCount = 0;
+	config->comparisonIndex = 0;
+	config->matrixMode = 0;
 	config->AmpBarRange = BAR_DIFF_DB_TOLERANCE;
 	config->FullTimeSpectroScale = 0;
 	config->hasTimeDomain = 0;
@@ -223,9 +264,7 @@ void CleanParameters(parameters *config)
 	config->thresholdMissingHiDif = MISS_HIDIFF;
 	config->thresholdExtraHiDif = EXTRA_HIDIFF;
 
-	config->sync_plan = NULL;
-	config->model_plan = NULL;
-	config->reverse_plan = NULL;
+	initPlans(&config->plans);
 
 	config->referenceSignal = NULL;
 	config->comparisonSignal = NULL;
@@ -252,25 +291,20 @@ void CleanParameters(parameters *config)
 	EnableLog();
 }
 
-int commandline(int argc , char *argv[], parameters *config)
+/* 
+	Applies one option as given in the command line, value is NULL for
+	flags. Used by commandline and by the engine API to set them one by one.
+*/
+int SetOption(int option, char *value, parameters *config)
 {
-	FILE *file = NULL;
-	int c, index, ref = 0, tar = 0;
-	
-	opterr = 0;
-	
-	CleanParameters(config);
-
-	// Available: GJKmq1234567
-	while ((c = getopt (argc, argv, "Aa:Bb:Cc:Dd:Ee:Ff:gHhIijkL:lMNn:Oo:P:p:QRr:Ss:TtUuVvWw:XxY:yZ:z0:89")) != -1)
-	switch (c)
+	switch (option)
 	  {
 	  case 'A':
 		config->averagePlot = 1;
 		config->weightedAveragePlot = 0;
 		break;
 	  case 'a':
-		config->zoomWaveForm = atof(optarg);
+		config->zoomWaveForm = atof(value);
 		if(config->zoomWaveForm > 0 || config->zoomWaveForm < -112)
 		{
 			logmsg("\t - Wave form Zoom Range must be between %d and %d, changed to %d\n", 0, -112, 0);
@@ -281,7 +315,7 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->channelBalance = 0;
 		break;
 	  case 'b':
-		config->AmpBarRange = atof(optarg);
+		config->AmpBarRange = atof(value);
 		if(config->AmpBarRange < 0 || config->AmpBarRange > 16)
 		{
 			logmsg("\t - Range must be between %d and %d, changed to %d\n", 0, 16, BAR_DIFF_DB_TOLERANCE);
@@ -292,14 +326,15 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->outputCSV = 1;
 		break;
 	  case 'c':
-		sprintf(config->comparisonFile, "%s", optarg);
-		tar = 1;
+		if(!AddComparisonFile(value, config))
+			return 0;
+		sprintf(config->comparisonFile, "%s", config->comparisonList[0]);
 		break;
 	  case 'D':
 		config->plotDifferences = 0;
 		break;
 	  case 'd':
-		config->maxDbPlotZC = atof(optarg);
+		config->maxDbPlotZC = atof(value);
 		if(config->maxDbPlotZC < 0 || config->maxDbPlotZC > 120.0)
 		{
 			logmsg("\t - Range must be between %d and %d, changed to %g\n", 0, 120.0, DB_HEIGHT);
@@ -310,16 +345,16 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->FullTimeSpectroScale = 1;
 		break;
 	  case 'e':
-		config->endHz = atof(optarg);
+		config->endHz = atof(value);
 		if(config->endHz < START_HZ*2.0)
 		{
 			config->endHz = END_HZ;
-			logmsg("\t -Requested %g end frequency is lower than possible, set to %g\n", atof(optarg), config->endHz);
+			logmsg("\t -Requested %g end frequency is lower than possible, set to %g\n", atof(value), config->endHz);
 		}
 		if(config->endHz > MAX_HZ)
 		{
 			config->endHz = MAX_HZ;
-			logmsg("\t -Requested %g end frequency is higher than possible, set to %g\n", atof(optarg), config->endHz);
+			logmsg("\t -Requested %g end frequency is higher than possible, set to %g\n", atof(value), config->endHz);
 		}
 		if(config->endHz > END_HZ)
 			config->endHzPlot = config->endHz;
@@ -328,13 +363,19 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->plotNoiseFloor = 0;
 		break;
 	  case 'f':
-		config->MaxFreq = atoi(optarg);
+		config->MaxFreq = atoi(value);
 		if(config->MaxFreq < 1 || config->MaxFreq > MAX_FREQ_COUNT)
 				{
 			logmsg("\t - Number fo frequencies must be between %d and %d, changed to %g\n", 1, MAX_FREQ_COUNT, MAX_FREQ_COUNT);
 			config->MaxFreq = MAX_FREQ_COUNT;
 		}
 		break;
+	  case 'G':
+		sprintf(config->plans.wisdomFile, "%s", value);
+		break;
+	  case 'J':
+		sprintf(config->cacheFolder, "%s", value);
+		break;
 	  case 'g':
 		config->averagePlot = 0;
 		break;
@@ -357,8 +398,16 @@ int commandline(int argc , char *argv[], parameters *config)
 	  case 'k':
 		config->clock = 1;
 		break;
+	  case 'K':
+		config->threads = atoi(value);
+		if(config->threads < 1 || config->threads > MAX_THREADS)
+		{
+			logmsg("\t - Thread count must be between 1 and %d, using 1\n", MAX_THREADS);
+			config->threads = 1;
+		}
+		break;
 	  case 'L':
-		switch(atoi(optarg))
+		switch(atoi(value))
 		{
 			case 1:
 				config->plotResX = PLOT_RES_X_LOW;
@@ -386,7 +435,7 @@ int commandline(int argc , char *argv[], parameters *config)
 				config->plotResY = PLOT_RES_Y_FP;
 				break;
 			default:
-				logmsg("\t -Invalid reslution (-%c) parameter %s, using default\n", optopt, optarg);
+				logmsg("\t -Invalid reslution (-%c) parameter %s, using default\n", option, value);
 				break;
 		}
 		break;
@@ -400,7 +449,7 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->logScale = 0;
 		break;
 	  case 'n':
-		switch(optarg[0])
+		switch(value[0])
 		{
 			case 't':
 				config->normType = max_time;
@@ -415,7 +464,7 @@ int commandline(int argc , char *argv[], parameters *config)
 				config->normType = none;
 				break;
 			default:
-				logmsg("Invalid Normalization option '%c'\n", optarg[0]);
+				logmsg("Invalid Normalization option '%c'\n", value[0]);
 				logmsg("\tUse 't' Time Domain Max, 'f' Frequency Domain Max or 'a' Average\n");
 				return 0;
 				break;
@@ -425,17 +474,17 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->plotPhase = 0;
 		break;
 	  case 'o':
-		config->outputFilterFunction = atoi(optarg);
+		config->outputFilterFunction = atoi(value);
 		if(config->outputFilterFunction < 0 || config->outputFilterFunction > 5)
 			config->outputFilterFunction = 3;
 		if(!config->outputFilterFunction)
 			config->useOutputFilter = 0;
 		break;
 	  case 'P':
-		sprintf(config->profileFile, "%s", optarg);
+		sprintf(config->profileFile, "%s", value);
 		break;
 	  case 'p':
-		config->significantAmplitude = atof(optarg);
+		config->significantAmplitude = atof(value);
 		if(config->significantAmplitude == 0)
 		{
 			config->noiseFloorAutoAdjust = 0;
@@ -457,23 +506,28 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->doSamplerateAdjust = 1;
 		break;
 	  case 'r':
-		sprintf(config->referenceFile, "%s", optarg);
-		ref = 1;
+		sprintf(config->referenceFile, "%s", value);
 		break;
 	  case 'S':
 		config->plotSpectrogram = 0;
 		break;
 	  case 's':
-		config->startHz = atof(optarg);
+		config->startHz = atof(value);
 		if(config->startHz < 1.0 || config->startHz > END_HZ-100.0)
 		{
 			config->startHz = START_HZ;
-			logmsg("\t -Requested %g start frequency is out of range, set to %g\n", atof(optarg), config->startHz);
+			logmsg("\t -Requested %g start frequency is out of range, set to %g\n", atof(value), config->startHz);
 		}
 		break;
 	  case 'T':
 		config->syncTolerance = 1;
 		break;
+	  case 'q':
+		config->quickSync = 1;
+		break;
+	  case 'm':
+		config->boundedMemory = 1;
+		break;
 	  case 't':
 		config->plotTimeSpectrogram = 0;
 		break;
@@ -493,17 +547,17 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->whiteBG = 1;
 		break;
 	 case 'w':
-		switch(optarg[0])
+		switch(value[0])
 		{
 			case 'n':
 			case 'f':
 			case 'h':
 			case 't':
 			case 'm':
-				config->window = optarg[0];
+				config->window = value[0];
 				break;
 			default:
-				logmsg("\t -Invalid Window for FFT option '%c'\n", optarg[0]);
+				logmsg("\t -Invalid Window for FFT option '%c'\n", value[0]);
 				logmsg("\t  Use n for None, t for Tukey window (default), f for Flattop, h for Hann or m for Hamming window\n");
 				return 0;
 				break;
@@ -517,7 +571,7 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->showAll = 1;
 		break;
 	  case 'Y':
-		config->videoFormatRef = atoi(optarg);
+		config->videoFormatRef = atoi(value);
 		if(config->videoFormatRef < 0 || config->videoFormatRef > MAX_SYNC)  // We'll confirm this later
 		{
 			logmsg("\tProfile can have up to %d types\n", MAX_SYNC);
@@ -528,7 +582,7 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->debugSync = 1;
 		break;
 	  case 'Z':
-		config->videoFormatCom = atoi(optarg);
+		config->videoFormatCom = atoi(value);
 		if(config->videoFormatRef < 0 || config->videoFormatRef > MAX_SYNC)
 		{
 			logmsg("\tProfile can have up to %d types\n", MAX_SYNC);
@@ -539,7 +593,37 @@ int commandline(int argc , char *argv[], parameters *config)
 		config->ZeroPad = 1;
 		break;
 	  case '0':
-		sprintf(config->outputPath, "%s", optarg);
+		sprintf(config->outputPath, "%s", value);
+		break;
+	  case '1':
+		if(!setPlanLevel(&config->plans, value[0]))
+		{
+			logmsg("Invalid FFTW planning level '%c'\n", value[0]);
+			logmsg("\tUse 'm' Measure (default), 'p' Patient or 'x' Exhaustive\n");
+			return 0;
+		}
+		break;
+	  case '2':
+		config->matrixMode = 1;
+		break;
+	  case '3':
+		config->snapshot = 1;
+		break;
+	  case '4':
+		switch(value[0])
+		{
+			case 'f':
+				config->floatFFT = FLOAT_FFT_ON;
+				break;
+			case 'v':
+				config->floatFFT = FLOAT_FFT_VALIDATE;
+				break;
+			default:
+				logmsg("Invalid single precision FFTW option '%c'\n", value[0]);
+				logmsg("\tUse 'f' Float or 'v' Validate against double precision\n");
+				return 0;
+				break;
+		}
 		break;
 	  case '8':
 		config->logScaleTS = 1;
@@ -547,50 +631,78 @@ int commandline(int argc , char *argv[], parameters *config)
 	  case '9':
 		config->compressToBlocks = 1;
 		break;
-	  case '?':
-		if (optopt == 'b')
-		  logmsg("\t ERROR: Bar Difference -%c option requires a real number.\n", optopt);
-		else if (optopt == 'c')
-		  logmsg("\t ERROR: Compare File -%c requires an argument.\n", optopt);
-		else if (optopt == 'd')
-		  logmsg("\t ERROR: Max DB Height for Plots -%c requires an argument: %g-%g\n", 0.1, 60.0, optopt);
-		else if (optopt == 'e')
-		  logmsg("\t ERROR: Max frequency range for FFTW -%c requires an argument: %d-%d\n", START_HZ*2, END_HZ, optopt);
-		else if (optopt == 'f')
-		  logmsg("\t ERROR: Max # of frequencies to use from FFTW -%c requires an argument: 1-%d\n", optopt, MAX_FREQ_COUNT);
-		else if (optopt == 'L')
-		  logmsg("\t ERROR: Plot Resolution -%c requires an argument: 1-6\n", optopt);
-		else if (optopt == 'n')
-		  logmsg("\t ERROR: Normalization type -%c requires an argument:\n\tUse 't' Time Domain Max, 'f' Frequency Domain Max or 'a' Average\n");
-		else if (optopt == 'o')
-		  logmsg("\t ERROR: Output curve -%c requires an argument 0-4\n", optopt);
-		else if (optopt == 'P')
-		  logmsg("\t ERROR: Profile File -%c requires a file argument\n", optopt);
-		else if (optopt == 'p')
-		  logmsg("\t ERROR: Significant Amplitude -%c requires an argument: -1.0 to -200.0 dBFS\n\t\tOr 0 for Auto Adjustment to Comparision Noise Floor\n", optopt);
-		else if (optopt == 'r')
-		  logmsg("\t ERROR: Reference File -%c requires an argument.\n", optopt);
-		else if (optopt == 's')
-		  logmsg("\t ERROR: Min frequency range for FFTW -%c requires an argument: %d-%d\n", 1, END_HZ-100, optopt);
-		else if (optopt == 'w')
-		  logmsg("\t ERROR: FFT Window option -%c requires an argument: n,t,f or h\n", optopt);
-		else if (optopt == 'Y')
-		  logmsg("\t ERROR: Reference format: needs a number with a selection from the profile\n");
-		else if (optopt == 'Z')
-		  logmsg("\t ERROR: Comparison format: needs a number with a selection from the profile\n");
-		else if (optopt == '0')
-		  logmsg("\t ERROR: Output folder argument -%c requires a valid path.\n", optopt);
-		else if (isprint (optopt))
-		  logmsg("\t ERROR: Unknown option `-%c'.\n", optopt);
-		else
-		  logmsg("\t ERROR: Unknown option character `\\x%x'.\n", optopt);
-		return 0;
-		break;
 	  default:
-		logmsg("\t ERROR: Invalid argument %c\n", optopt);
+		logmsg("\t ERROR: Invalid argument %c\n", option);
 		return(0);
 		break;
 	  }
+	return 1;
+}
+
+int commandline(int argc , char *argv[], parameters *config)
+{
+	FILE *file = NULL;
+	int c, index;
+	
+	opterr = 0;
+	
+	CleanParameters(config);
+
+	while ((c = getopt (argc, argv, MDF_OPTIONS)) != -1)
+	{
+		if(c == '?')
+		{
+			if (optopt == 'b')
+				logmsg("\t ERROR: Bar Difference -%c option requires a real number.\n", optopt);
+			else if (optopt == 'c')
+				logmsg("\t ERROR: Compare File -%c requires an argument.\n", optopt);
+			else if (optopt == 'd')
+				logmsg("\t ERROR: Max DB Height for Plots -%c requires an argument: %g-%g\n", 0.1, 60.0, optopt);
+			else if (optopt == 'e')
+				logmsg("\t ERROR: Max frequency range for FFTW -%c requires an argument: %d-%d\n", START_HZ*2, END_HZ, optopt);
+			else if (optopt == 'f')
+				logmsg("\t ERROR: Max # of frequencies to use from FFTW -%c requires an argument: 1-%d\n", optopt, MAX_FREQ_COUNT);
+			else if (optopt == 'G')
+				logmsg("\t ERROR: FFTW wisdom file -%c requires a file argument\n", optopt);
+			else if (optopt == 'K')
+				logmsg("\t ERROR: Thread count -%c requires an argument: 1-%d\n", optopt, MAX_THREADS);
+			else if (optopt == 'L')
+				logmsg("\t ERROR: Plot Resolution -%c requires an argument: 1-6\n", optopt);
+			else if (optopt == 'n')
+				logmsg("\t ERROR: Normalization type -%c requires an argument:\n\tUse 't' Time Domain Max, 'f' Frequency Domain Max or 'a' Average\n");
+			else if (optopt == 'o')
+				logmsg("\t ERROR: Output curve -%c requires an argument 0-4\n", optopt);
+			else if (optopt == 'P')
+				logmsg("\t ERROR: Profile File -%c requires a file argument\n", optopt);
+			else if (optopt == 'p')
+				logmsg("\t ERROR: Significant Amplitude -%c requires an argument: -1.0 to -200.0 dBFS\n\t\tOr 0 for Auto Adjustment to Comparision Noise Floor\n", optopt);
+			else if (optopt == 'r')
+				logmsg("\t ERROR: Reference File -%c requires an argument.\n", optopt);
+			else if (optopt == 's')
+				logmsg("\t ERROR: Min frequency range for FFTW -%c requires an argument: %d-%d\n", 1, END_HZ-100, optopt);
+			else if (optopt == 'w')
+				logmsg("\t ERROR: FFT Window option -%c requires an argument: n,t,f or h\n", optopt);
+			else if (optopt == 'Y')
+				logmsg("\t ERROR: Reference format: needs a number with a selection from the profile\n");
+			else if (optopt == 'Z')
+				logmsg("\t ERROR: Comparison format: needs a number with a selection from the profile\n");
+			else if (optopt == 'J')
+				logmsg("\t ERROR: Analysis cache -%c requires a folder argument\n", optopt);
+			else if (optopt == '0')
+				logmsg("\t ERROR: Output folder argument -%c requires a valid path.\n", optopt);
+			else if (optopt == '1')
+				logmsg("\t ERROR: FFTW planning level -%c requires an argument: m, p or x\n", optopt);
+			else if (optopt == '4')
+				logmsg("\t ERROR: Single precision FFTW -%c requires an argument: f or v\n", optopt);
+			else if (isprint (optopt))
+				logmsg("\t ERROR: Unknown option `-%c'.\n", optopt);
+			else
+				logmsg("\t ERROR: Unknown option character `\\x%x'.\n", optopt);
+			return 0;
+		}
+		if(!SetOption(c, optarg, config))
+			return 0;
+	}
 	
 	for(index = optind; index < argc; index++)
 	{
@@ -598,13 +710,46 @@ int commandline(int argc , char *argv[], parameters *config)
 		return 0;
 	}
 
-	if(!ref || !tar)
+	if(!config->referenceFile[0] || !config->comparisonCount)
 	{
 		logmsg("  usage: mdfourier -P profile.mdf -r reference.wav -c compare.wav\n");
 		logmsg("  ERROR: Please define both reference and compare audio files\n");
 		return 0;
 	}
 
+	file = fopen(config->profileFile, "rb");
+	if(!file)
+	{
+		logmsg("* ERROR: Could not load profile configuration file: \"%s\"\n", config->profileFile);
+		return 0;
+	}
+	fclose(file);
+
+	file = fopen(config->referenceFile, "rb");
+	if(!file)
+	{
+		logmsg("* ERROR: Could not open REFERENCE file: \"%s\"\n", config->referenceFile);
+		return 0;
+	}
+	fclose(file);
+
+	for(int i = 0; i < config->comparisonCount; i++)
+	{
+		file = fopen(config->comparisonList[i], "rb");
+		if(!file)
+		{
+			logmsg("* ERROR: Could not open COMPARE file: \"%s\"\n", config->comparisonList[i]);
+			return 0;
+		}
+		fclose(file);
+	}
+
+	return(CheckParameters(config));
+}
+
+/* Validates and completes the options once they are all set */
+int CheckParameters(parameters *config)
+{
 	if(config->FullTimeSpectroScale)
 		config->MaxFreq = END_HZ;
 
@@ -618,7 +763,8 @@ int commandline(int argc , char *argv[], parameters *config)
 		return 0;
 	}
 
-	if(!config->plotDifferences && !config->plotMissing &&
+	// The matrix has no plots
+	if(!config->matrixMode && !config->plotDifferences && !config->plotMissing &&
 		!config->plotSpectrogram && !config->averagePlot &&
 		!config->plotNoiseFloor && !config->plotTimeSpectrogram &&
 		!config->plotTimeDomain && !config->plotPhase)
@@ -627,30 +773,6 @@ int commandline(int argc , char *argv[], parameters *config)
 		return 0;
 	}
 
-	file = fopen(config->profileFile, "rb");
-	if(!file)
-	{
-		logmsg("* ERROR: Could not load profile configuration file: \"%s\"\n", config->profileFile);
-		return 0;
-	}
-	fclose(file);
-
-	file = fopen(config->referenceFile, "rb");
-	if(!file)
-	{
-		logmsg("* ERROR: Could not open REFERENCE file: \"%s\"\n", config->referenceFile);
-		return 0;
-	}
-	fclose(file);
-
-	file = fopen(config->comparisonFile, "rb");
-	if(!file)
-	{
-		logmsg("* ERROR: Could not open COMPARE file: \"%s\"\n", config->comparisonFile);
-		return 0;
-	}
-	fclose(file);
-
 	if(config->verbose)
 	{
 		if(config->window != 'n')
@@ -678,6 +800,25 @@ int commandline(int argc , char *argv[], parameters *config)
 		logmsg("\t -Full Time spectrogram selected, this is slower\n");
 	if(config->ZeroPad && config->FullTimeSpectroScale)
 		logmsg("\t -Go and play an arcade game credit if you have a slow CPU like mine...\n");
+	if(config->boundedMemory)
+		logmsg("\t -Memory is bounded, samples are released after each block is processed and FLAC is decoded on demand\n");
+	if(config->cacheFolder[0])
+		logmsg("\t -Reference analysis is cached in \"%s\"\n", config->cacheFolder);
+	if(config->quickSync)
+		logmsg("\t -Sync pulses will be located with a coarse search and Goertzel filters\n");
+	if(config->threads > 1)
+		logmsg("\t -Using %d threads for file and block processing\n", config->threads);
+	if(config->matrixMode)
+		logmsg("\t -Comparing %d files against each other\n", config->comparisonCount + 1);
+	else if(config->comparisonCount > 1)
+		logmsg("\t -Comparing the Reference against %d files\n", config->comparisonCount);
+	if(config->plans.planFlags != FFTW_MEASURE)
+		logmsg("\t -Tuning FFTW plans with %s, this is slower but is saved to \"%s\"\n",
+			getPlanLevelName(&config->plans), config->plans.wisdomFile);
+	if(config->floatFFT == FLOAT_FFT_ON)
+		logmsg("\t -FFTW runs in single precision\n");
+	if(config->floatFFT == FLOAT_FFT_VALIDATE)
+		logmsg("\t -FFTW runs in both precisions, single precision is validated against double\n");
 	if(config->ignoreFloor)
 		logmsg("\t -Ignoring Silence block noise floor\n");
 	if(config->MaxFreq != FREQ_COUNT)
@@ -704,10 +845,94 @@ int commandline(int argc , char *argv[], parameters *config)
 	return 1;
 }
 
+int AddComparisonName(char *name, parameters *config)
+{
+	char	**list = NULL;
+
+	list = (char**)realloc(config->comparisonList, sizeof(char*)*(config->comparisonCount+1));
+	if(!list)
+	{
+		logmsg("ERROR: Not enough memory for the Comparison list\n");
+		return 0;
+	}
+	config->comparisonList = list;
+	config->comparisonList[config->comparisonCount] = (char*)malloc(sizeof(char)*BUFFER_SIZE);
+	if(!config->comparisonList[config->comparisonCount])
+	{
+		logmsg("ERROR: Not enough memory for the Comparison list\n");
+		return 0;
+	}
+	snprintf(config->comparisonList[config->comparisonCount], BUFFER_SIZE, "%s", name);
+	config->comparisonCount++;
+	return 1;
+}
+
+/* -c can be repeated, or be @file with one Comparison per line */
+int AddComparisonFile(char *name, parameters *config)
+{
+	FILE	*list = NULL;
+	char	line[BUFFER_SIZE];
+
+	if(name[0] != '@')
+		return(AddComparisonName(name, config));
+
+	list = fopen(name+1, "r");
+	if(!list)
+	{
+		logmsg("* ERROR: Could not open Comparison list: \"%s\"\n", name+1);
+		return 0;
+	}
+	while(fgets(line, BUFFER_SIZE, list))
+	{
+		int len = strlen(line);
+
+		while(len && (line[len-1] == '\n' || line[len-1] == '\r' || line[len-1] == ' '))
+			line[--len] = '\0';
+		if(!len || line[0] == '#')
+			continue;
+		if(!AddComparisonName(line, config))
+		{
+			fclose(list);
+			return 0;
+		}
+	}
+	fclose(list);
+
+	if(!config->comparisonCount)
+	{
+		logmsg("* ERROR: Comparison list \"%s\" is empty\n", name+1);
+		return 0;
+	}
+	return 1;
+}
+
+int ComparisonNameRepeats(char *name, parameters *config)
+{
+	char	fn[BUFFER_SIZE/2];
+
+	for(int i = 0; i < config->comparisonIndex && i < config->comparisonCount; i++)
+	{
+		ShortenFileName(basename(config->comparisonList[i]), fn);
+		if(strcmp(fn, name) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+void ReleaseComparisonList(parameters *config)
+{
+	for(int i = 0; i < config->comparisonCount; i++)
+		free(config->comparisonList[i]);
+	if(config->comparisonList)
+		free(config->comparisonList);
+	config->comparisonList = NULL;
+	config->comparisonCount = 0;
+}
+
 int checkPath(char *path)
 {
-	int		len = 0;
-	char 	*CurrentPath = NULL;
+	int			len = 0;
+	struct stat	info;
 
 	if(!path || strlen(path) == 0)
 		return 1;
@@ -727,25 +952,12 @@ int checkPath(char *path)
 		}
 	}
 
-	CurrentPath = (char*)malloc(sizeof(char)*FILENAME_MAX);
-	if(!CurrentPath)
-		return 0;
-
-	if(!GetCurrentDir(CurrentPath, sizeof(char)*FILENAME_MAX))
-	{
-		free(CurrentPath);
-		logmsg("Could not get current path\n");
-		return 0;
-	}
-
-	if(chdir(path) == -1)
+	// The working folder is shared by the whole process, so it is never changed
+	if(stat(path, &info) != 0 || !S_ISDIR(info.st_mode))
 	{
-		free(CurrentPath);
 		logmsg("Could not open selected path '%s'\n", path);
 		return 0;
 	}
-
-	PopMainPath(&CurrentPath);
 	return 1;
 }
 
@@ -785,58 +997,16 @@ int checkAlternatePaths(parameters *config)
 	return 1;
 }
 
-char *PushMainPath(parameters *config)
-{
-	char 	*CurrentPath = NULL;
-
-	if(strlen(config->outputPath) == 0)
-		return NULL;
-
-	CurrentPath = (char*)malloc(sizeof(char)*FILENAME_MAX);
-	if(!CurrentPath)
-		return NULL;
-
-	if(!GetCurrentDir(CurrentPath, sizeof(char)*FILENAME_MAX))
-	{
-		free(CurrentPath);
-		logmsg("Could not get current path\n");
-		return NULL;
-	}
-
-	if(chdir(config->outputPath) == -1)
-	{
-		free(CurrentPath);
-		logmsg("Could not change to selected path '%s'\n", config->outputPath);
-		return NULL;
-	}
-	return CurrentPath;
-}
-
-void PopMainPath(char **CurrentPath)
-{
-	if(!CurrentPath || !*CurrentPath)
-		return;
-
-	if(chdir(*CurrentPath) == -1)
-		logmsg("Could not open working folder %s\n", CurrentPath);
-
-	free(*CurrentPath);
-	*CurrentPath = NULL;
-}
-
 int SetupFolders(char *folder, char *logname, parameters *config)
 {
-	char *mainDir = NULL;
-
 	if(!checkAlternatePaths(config))
 		return 0;
 
-	mainDir = PushMainPath(config);
 	if(!CreateFolderName(folder, config))
-	{
-		PopMainPath(&mainDir);
 		return 0;
-	}
+
+	if(!StartTrace(config))
+		return 0;
 
 	if(IsLogEnabled())
 	{
@@ -848,15 +1018,10 @@ int SetupFolders(char *folder, char *logname, parameters *config)
 		ComposeFileName(tmp, logfname, ".txt", config);
 
 		if(!setLogName(tmp))
-		{
-			PopMainPath(&mainDir);
 			return 0;
-		}
 
 		Header(1, 0, NULL);
 	}
-
-	PopMainPath(&mainDir);
 	return 1;
 }
 
@@ -969,6 +1134,7 @@ int CreateFolderName(char *mainfolder, parameters *config)
 {
 	int len = 0;
 	char tmp[BUFFER_SIZE/2], fn[BUFFER_SIZE/2], pname[BUFFER_SIZE/2];
+	char path[BUFFER_SIZE*4];
 
 	if(!config)
 		return 0;
@@ -979,11 +1145,19 @@ int CreateFolderName(char *mainfolder, parameters *config)
 
 	ShortenFileName(basename(config->referenceFile), tmp);
 	len = strlen(tmp);
-	if(strlen(config->comparisonFile))
+	if(config->matrixMode)
+	{
+		sprintf(tmp+len, "_matrix");
+		len = strlen(tmp);
+	}
+	else if(strlen(config->comparisonFile))
 	{
 		ShortenFileName(basename(config->comparisonFile), fn);
 		sprintf(tmp+len, "_vs_%s", fn);
 
+		// Same names from different folders in a batch get their own results
+		if(ComparisonNameRepeats(fn, config))
+			sprintf(tmp+strlen(tmp), "_%d", config->comparisonIndex + 1);
 		len = strlen(tmp);
 	}
 
@@ -1003,18 +1177,21 @@ int CreateFolderName(char *mainfolder, parameters *config)
 	sprintf(config->compareName, "%s", tmp);
 	sprintf(config->folderName, "%s%c%s", mainfolder, FOLDERCHAR, pname);
 
-	if(!CreateFolder(mainfolder))
+	ComposeOutputPath(path, mainfolder, config);
+	if(!CreateFolder(path))
 	{
 		logmsg("ERROR: Could not create '%s'\n", mainfolder);
 		return 0;
 	}
-	if(!CreateFolder(config->folderName))
+	ComposeOutputPath(path, config->folderName, config);
+	if(!CreateFolder(path))
 	{
 		logmsg("ERROR: Could not create '%s'\n", config->folderName);
 		return 0;
 	}
 	sprintf(config->folderName, "%s%c%s%c%s", mainfolder, FOLDERCHAR, pname, FOLDERCHAR, tmp);
-	if(!CreateFolder(config->folderName))
+	ComposeOutputPath(path, config->folderName, config);
+	if(!CreateFolder(path))
 	{
 		logmsg("ERROR: Could not create '%s'\n", config->folderName);
 		return 0;
@@ -1057,21 +1234,34 @@ char *GetNormalization(enum normalize n)
 	}
 }
 
+/* Paths in config are relative to the output path, if one was given */
+void ComposeOutputPath(char *target, char *path, parameters *config)
+{
+	if(!config)
+		return;
+
+	sprintf(target, "%s%s", config->outputPath, path);
+}
+
 void ComposeFileName(char *target, char *subname, char *ext, parameters *config)
 {
 	if(!config)
 		return;
 
-	sprintf(target, "%s%c%s%s",
-		config->folderName, FOLDERCHAR, subname, ext); 
+	sprintf(target, "%s%s%c%s%s",
+		config->outputPath, config->folderName, FOLDERCHAR, subname, ext); 
 }
 
+/* Within the folder plots are going to, see PushFolder */
 void ComposeFileNameoPath(char *target, char *subname, char *ext, parameters *config)
 {
 	if(!config)
 		return;
 
-	sprintf(target, "%s%s", subname, ext); 
+	if(config->workFolder[0])
+		sprintf(target, "%s%c%s%s", config->workFolder, FOLDERCHAR, subname, ext);
+	else
+		sprintf(target, "%s%s", subname, ext); 
 }
 
 double TimeSpecToSeconds(struct timespec* ts)
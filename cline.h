@@ -39,14 +39,24 @@
 	#define GetCurrentDir getcwd
 #endif
 
+// Available: 567
+#define MDF_OPTIONS	"Aa:Bb:Cc:Dd:Ee:Ff:G:gHhIiJ:jkK:L:lmMNn:Oo:P:p:qQRr:Ss:TtUuVvWw:XxY:yZ:z0:1:234:89"
+
 int SetupFolders(char *folder, char *logname, parameters *config);
 int CreateFolder(char *name);
 int CreateFolderName(char *mainfolder, parameters *config);
 void InvertComparedName(parameters *config);
+void ComposeOutputPath(char *target, char *path, parameters *config);
 void ComposeFileName(char *target, char *subname, char *ext, parameters *config);
 void ComposeFileNameoPath(char *target, char *subname, char *ext, parameters *config);
 void CleanParameters(parameters *config);
 int commandline(int argc , char *argv[], parameters *config);
+int SetOption(int option, char *value, parameters *config);
+int CheckParameters(parameters *config);
+int AddComparisonName(char *name, parameters *config);
+int AddComparisonFile(char *name, parameters *config);
+int ComparisonNameRepeats(char *name, parameters *config);
+void ReleaseComparisonList(parameters *config);
 char *GetChannel(char c);
 char *GetWindow(char c);
 int Header(int log, int argc, char *argv[]);
@@ -57,8 +67,6 @@ int getExtensionLength(char *filename);
 void ShortenFileName(char *filename, char *copy);
 int CleanFolderName(char *name, char *origName);
 
-char *PushMainPath(parameters *config);
-void PopMainPath(char **CurrentPath);
 
 #endif
 
@@ -170,6 +170,45 @@ int CreateDifferenceArray(parameters *config)
 	return 1;
 }
 
+/*
+	Insert and Increment only touch the per block counters, so blocks can be
+	compared in parallel. The totals are added up afterwards in block order.
+*/
+void SumDifferenceTotals(parameters *config)
+{
+	AudioDifference	*Differences = NULL;
+
+	if(!config)
+		return;
+
+	Differences = &config->Differences;
+	if(!Differences->BlockDiffArray)
+		return;
+
+	Differences->cntFreqAudioDiff = 0;
+	Differences->cntAmplAudioDiff = 0;
+	Differences->cntPhaseAudioDiff = 0;
+	Differences->cmpPhaseAudioDiff = 0;
+
+	Differences->cntPerfectAmplMatch = 0;
+	Differences->cntTotalCompared = 0;
+	Differences->cntTotalAudioDiff = 0;
+
+	for(int i = 0; i < config->types.totalBlocks; i++)
+	{
+		BlockDifference *BlockDiff = &Differences->BlockDiffArray[i];
+
+		Differences->cntFreqAudioDiff += BlockDiff->cntFreqBlkDiff;
+		Differences->cntAmplAudioDiff += BlockDiff->cntAmplBlkDiff;
+		Differences->cntPhaseAudioDiff += BlockDiff->cntPhaseBlkDiff;
+		Differences->cmpPhaseAudioDiff += BlockDiff->cmpPhaseBlkDiff;
+
+		Differences->cntPerfectAmplMatch += BlockDiff->perfectAmplMatch;
+		Differences->cntTotalCompared += BlockDiff->cmpAmplBlkDiff;
+		Differences->cntTotalAudioDiff += BlockDiff->cntAmplBlkDiff + BlockDiff->cntFreqBlkDiff;
+	}
+}
+
 void ReleaseDifferenceArray(parameters *config)
 {
 	if(!config)
@@ -237,7 +276,6 @@ int IncrementCmpPhaseDifference(int block, parameters *config)
 		return 0;
 
 	config->Differences.BlockDiffArray[block].cmpPhaseBlkDiff ++;
-	config->Differences.cmpPhaseAudioDiff ++;
 	return 1;
 }
 
@@ -284,8 +322,6 @@ int InsertAmplDifference(int block, Frequency ref, Frequency comp, char channel,
 	config->Differences.BlockDiffArray[block].amplDiffArray[position].channel = channel;
 
 	config->Differences.BlockDiffArray[block].cntAmplBlkDiff ++;
-	config->Differences.cntAmplAudioDiff ++;
-	config->Differences.cntTotalAudioDiff ++;
 	
 	return 1;
 }
@@ -339,8 +375,6 @@ int InsertPhaseDifference(int block, Frequency ref, Frequency comp, char channel
 	config->Differences.BlockDiffArray[block].phaseDiffArray[position].channel = channel;
 
 	config->Differences.BlockDiffArray[block].cntPhaseBlkDiff ++;
-	config->Differences.cntPhaseAudioDiff ++;
-	//config->Differences.cntTotalAudioDiff ++;
 	
 	return 1;
 }
@@ -350,7 +384,6 @@ int IncrementCompared(int block, parameters *config)
 	if(!config)
 		return 0;
 
-	config->Differences.cntTotalCompared ++;
 	if(!IncrementCmpAmplDifference(block, config))
 		return 0;
 	if(!IncrementCmpFreqNotFound(block, config))
@@ -372,7 +405,6 @@ int IncrementPerfectMatch(int block, parameters *config)
 		return 0;
 
 	config->Differences.BlockDiffArray[block].perfectAmplMatch ++;
-	config->Differences.cntPerfectAmplMatch ++;
 	
 	return 1;
 }
@@ -420,8 +452,6 @@ int InsertFreqNotFound(int block, double freq, double amplitude, char channel, p
 	config->Differences.BlockDiffArray[block].freqMissArray[position].channel = channel;
 
 	config->Differences.BlockDiffArray[block].cntFreqBlkDiff ++;
-	config->Differences.cntFreqAudioDiff ++;
-	config->Differences.cntTotalAudioDiff ++;
 
 	return 1;
 }
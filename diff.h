@@ -45,6 +45,7 @@ int IncrementPerfectMatch(int block, parameters *config);
 void PrintDifferentFrequencies(int block, parameters *config);
 void PrintDifferentAmplitudes(int block, parameters *config);
 void PrintDifferenceArray(parameters *config);
+void SumDifferenceTotals(parameters *config);
 void ReleaseDifferenceArray(parameters *config);
 
 long int FindDifferenceAveragesperBlock(double thresholdAmplitude, double thresholdMissing, double thresholdExtra, parameters *config);
@@ -0,0 +1,395 @@
+/* 
+ * MDFourier
+ * A Fourier Transform analysis tool to compare game console audio
+ * http://junkerhq.net/MDFourier/
+ *
+ * Copyright (C)2019-2020 Artemio Urbina
+ *
+ * This file is part of the 240p Test Suite
+ *
+ * You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA	02111-1307	USA
+ *
+ * Requires the FFTW library: 
+ *	  http://www.fftw.org/
+ * 
+ */
+
+#include "mdfourier.h"
+#include "engine.h"
+#include "log.h"
+#include "cline.h"
+#include "profile.h"
+#include "plans.h"
+#include "freq.h"
+#include "cache.h"
+#include "analysis.h"
+#include "trace.h"
+
+struct mdf_engine_st {
+	parameters	config;
+	parameters	base;		// as left by the profile, each pair starts from it
+	logContext	log;
+	int			logging;
+	int			profileLoaded;
+};
+
+/* Messages from the call and its workers go to this engine's log */
+logContext *EnterEngine(MDFEngine *engine)
+{
+	logContext	*previous = NULL;
+
+	previous = getLogContext();
+	setLogContext(&engine->log);
+	return previous;
+}
+
+MDFEngine *MDFCreate(int console)
+{
+	MDFEngine	*engine = NULL;
+	logContext	*previous = NULL;
+
+	engine = (MDFEngine*)malloc(sizeof(MDFEngine));
+	if(!engine)
+		return NULL;
+	memset(engine, 0, sizeof(MDFEngine));
+	initLogContext(&engine->log, console);
+
+	previous = EnterEngine(engine);
+	CleanParameters(&engine->config);
+	setLogContext(previous);
+	return engine;
+}
+
+void MDFFree(MDFEngine *engine)
+{
+	logContext	*previous = NULL;
+	parameters	*config = NULL;
+
+	if(!engine)
+		return;
+
+	previous = EnterEngine(engine);
+	config = &engine->config;
+	if(config->processedReference)
+	{
+		ReleaseAudio(config->processedReference, config);
+		free(config->processedReference);
+		config->processedReference = NULL;
+	}
+	ReleaseAudioBlockStructure(config);
+	exportWisdom(&config->plans);
+
+	// base and config share the list, comparisons added later only went to base
+	if(engine->profileLoaded)
+		ReleaseComparisonList(&engine->base);
+	else
+		ReleaseComparisonList(config);
+	if(IsLogEnabled())
+		endLog();
+	setLogContext(previous);
+
+	free(engine);
+}
+
+int MDFOptionValue(char option)
+{
+	char	*spec = NULL;
+
+	if(option == ':' || option == '\0')
+		return -1;
+	spec = strchr(MDF_OPTIONS, option);
+	if(!spec)
+		return -1;
+	return(spec[1] == ':' ? 1 : 0);
+}
+
+int MDFSetOptionInternal(MDFEngine *engine, char option, char *value)
+{
+	int	needsValue = 0;
+
+	if(engine->profileLoaded)
+	{
+		logmsg("ERROR: Options must be set before the profile is loaded (-%c)\n", option);
+		return 0;
+	}
+
+	needsValue = MDFOptionValue(option);
+	if(needsValue == -1)
+	{
+		logmsg("ERROR: Invalid option -%c\n", option);
+		return 0;
+	}
+	if(needsValue && !value)
+	{
+		logmsg("ERROR: Option -%c requires an argument\n", option);
+		return 0;
+	}
+	return(SetOption(option, value, &engine->config));
+}
+
+int MDFSetOption(MDFEngine *engine, char option, char *value)
+{
+	logContext	*previous = NULL;
+	int			result = 0;
+
+	if(!engine)
+		return 0;
+
+	previous = EnterEngine(engine);
+	result = MDFSetOptionInternal(engine, option, value);
+	setLogContext(previous);
+	return result;
+}
+
+int MDFCommandLine(MDFEngine *engine, int argc, char *argv[])
+{
+	logContext	*previous = NULL;
+	int			result = 0;
+
+	if(!engine)
+		return 0;
+
+	previous = EnterEngine(engine);
+	result = commandline(argc, argv, &engine->config);
+	setLogContext(previous);
+	return result;
+}
+
+int MDFLoadProfileInternal(MDFEngine *engine, char *profile)
+{
+	parameters	*config = NULL;
+
+	config = &engine->config;
+	if(engine->profileLoaded)
+	{
+		logmsg("ERROR: The profile was already loaded\n");
+		return 0;
+	}
+	if(profile)
+		sprintf(config->profileFile, "%s", profile);
+
+	if(!CheckParameters(config))
+		return 0;
+	if(!LoadProfile(config))
+		return 0;
+	if(!EndProfileLoad(config))
+		return 0;
+
+	engine->logging = IsLogEnabled();
+	engine->base = *config;
+	engine->profileLoaded = 1;
+	return 1;
+}
+
+int MDFLoadProfile(MDFEngine *engine, char *profile)
+{
+	logContext	*previous = NULL;
+	int			result = 0;
+
+	if(!engine)
+		return 0;
+
+	previous = EnterEngine(engine);
+	result = MDFLoadProfileInternal(engine, profile);
+	setLogContext(previous);
+	return result;
+}
+
+int MDFAnalyzeInternal(MDFEngine *engine, char *reference)
+{
+	parameters	*config = NULL;
+	int			result = 0;
+
+	config = &engine->config;
+	if(!engine->profileLoaded)
+	{
+		logmsg("ERROR: Load a profile before the Reference\n");
+		return 0;
+	}
+
+	if(config->processedReference)
+	{
+		ReleaseAudio(config->processedReference, config);
+		free(config->processedReference);
+		config->processedReference = NULL;
+	}
+	sprintf(engine->base.referenceFile, "%s", reference);
+	RestorePairParameters(config, &engine->base);
+	config->hasSilenceOverRide = 0;
+
+	if(!ReferenceReusable(config))
+		return 1;
+
+	logmsg("\n* Processing Reference %s\n", reference);
+	result = ProcessReference(config);
+	if(!result)
+		logmsg("Aborting\n");
+	return result;
+}
+
+/* The Reference is processed once here when possible, each MDFCompare starts from a copy */
+int MDFAnalyze(MDFEngine *engine, char *reference)
+{
+	logContext	*previous = NULL;
+	int			result = 0;
+
+	if(!engine || !reference)
+		return 0;
+
+	previous = EnterEngine(engine);
+	result = MDFAnalyzeInternal(engine, reference);
+	setLogContext(previous);
+	return result;
+}
+
+int MDFCompareInternal(MDFEngine *engine, char *comparison, MDFResults *results)
+{
+	PairResults	pair;
+	int			result = 0;
+
+	if(!engine->profileLoaded || !engine->base.referenceFile[0])
+	{
+		logmsg("ERROR: Load a profile and a Reference before comparing\n");
+		return 0;
+	}
+	if(!AddComparisonName(comparison, &engine->base))
+		return 0;
+
+	memset(&pair, 0, sizeof(PairResults));
+	engine->base.pairResults = &pair;
+	result = RunBatchPair(engine->base.comparisonCount - 1, NULL, engine->logging, &engine->base, &engine->config);
+	engine->base.pairResults = NULL;
+	engine->config.pairResults = NULL;
+
+	// Each call compares one file, the list doesn't grow with the calls
+	engine->base.comparisonCount--;
+	free(engine->base.comparisonList[engine->base.comparisonCount]);
+	engine->base.comparisonList[engine->base.comparisonCount] = NULL;
+
+	if(result && results)
+	{
+		memset(results, 0, sizeof(MDFResults));
+		results->averageDifference = pair.averageDifference;
+		results->missingPercent = pair.missingPercent;
+		results->extraPercent = pair.extraPercent;
+		results->highDiffBlocks = pair.highDiffBlocks;
+		snprintf(results->folder, MDF_PATH_SIZE, "%s%s",
+			engine->config.outputPath, engine->config.folderName);
+	}
+	return result;
+}
+
+int MDFCompare(MDFEngine *engine, char *comparison, MDFResults *results)
+{
+	logContext	*previous = NULL;
+	int			result = 0;
+
+	if(!engine || !comparison)
+		return 0;
+
+	previous = EnterEngine(engine);
+	result = MDFCompareInternal(engine, comparison, results);
+	setLogContext(previous);
+	return result;
+}
+
+int MDFRunInternal(MDFEngine *engine)
+{
+	AudioSignal  		*ReferenceSignal = NULL;
+	AudioSignal  		*ComparisonSignal = NULL;
+	parameters			*config = NULL;
+	struct	timespec	start;
+	int					result = 0;
+
+	config = &engine->config;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if(!LoadProfile(config))
+	{
+		logmsg("Aborting\n");
+		return 0;
+	}
+
+	if(!SetupFolders(config->outputFolder, "Log", config))
+	{
+		logmsg("Aborting\n");
+		return 0;
+	}
+
+	if(!EndProfileLoad(config))
+	{
+		logmsg("Aborting\n");
+		return 0;
+	}
+
+	if(config->matrixMode)
+	{
+		result = RunComparisonMatrix(config) ? 0 : 1;
+		CleanUp(&ReferenceSignal, &ComparisonSignal, config);
+		PrintElapsedTime(&start);
+		SaveTrace(config);
+		if(IsLogEnabled())
+			endLog();
+		logmsg("\nResults stored in %s%s\n", 
+				config->outputPath,
+				config->folderName);
+		return result;
+	}
+
+	if(config->comparisonCount > 1)
+	{
+		result = RunComparisonBatch(config) ? 0 : 1;
+		CleanUp(&ReferenceSignal, &ComparisonSignal, config);
+		PrintElapsedTime(&start);
+		return result;
+	}
+
+	if(strcmp(config->referenceFile, config->comparisonFile) == 0)
+	{
+		CleanUp(&ReferenceSignal, &ComparisonSignal, config);
+		logmsg("Both inputs are the same file %s, skipping to save time\n",
+			 config->referenceFile);
+		return 0;
+	}
+
+	if(!ProcessPair(&ReferenceSignal, &ComparisonSignal, config))
+	{
+		CleanUp(&ReferenceSignal, &ComparisonSignal, config);
+		return 0;
+	}
+
+	CleanUp(&ReferenceSignal, &ComparisonSignal, config);
+	PrintElapsedTime(&start);
+
+	logmsg("\nResults stored in %s%s\n", 
+			config->outputPath,
+			config->folderName);
+	return 1;
+}
+
+int MDFRun(MDFEngine *engine)
+{
+	logContext	*previous = NULL;
+	int			result = 0;
+
+	if(!engine)
+		return 0;
+
+	previous = EnterEngine(engine);
+	result = MDFRunInternal(engine);
+	SaveTrace(&engine->config);
+	setLogContext(previous);
+	return result;
+}
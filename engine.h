@@ -0,0 +1,67 @@
+/* 
+ * MDFourier
+ * A Fourier Transform analysis tool to compare game console audio
+ * http://junkerhq.net/MDFourier/
+ *
+ * Copyright (C)2019-2020 Artemio Urbina
+ *
+ * This file is part of the 240p Test Suite
+ *
+ * You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA	02111-1307	USA
+ *
+ * Requires the FFTW library: 
+ *	  http://www.fftw.org/
+ * 
+ */
+
+#ifndef MDFOURIER_ENGINE_H
+#define MDFOURIER_ENGINE_H
+
+/*
+	libmdfourier, each engine holds its own parameters, plans and log,
+	so several can run in the same process. Calls on the same engine
+	must not overlap.
+*/
+
+#define MDF_PATH_SIZE	12288
+
+typedef struct mdf_engine_st MDFEngine;
+
+typedef struct mdf_results_st {
+	double	averageDifference;
+	double	missingPercent;
+	double	extraPercent;
+	int		highDiffBlocks;
+	char	folder[MDF_PATH_SIZE];
+} MDFResults;
+
+MDFEngine *MDFCreate(int console);
+void MDFFree(MDFEngine *engine);
+
+/* Same letters and values as the command line, before the profile is loaded */
+int MDFSetOption(MDFEngine *engine, char option, char *value);
+/* -1 for an unknown option, 1 when it takes a value */
+int MDFOptionValue(char option);
+/* Uses getopt, so only one thread should parse a command line at a time */
+int MDFCommandLine(MDFEngine *engine, int argc, char *argv[]);
+
+int MDFLoadProfile(MDFEngine *engine, char *profile);
+int MDFAnalyze(MDFEngine *engine, char *reference);
+int MDFCompare(MDFEngine *engine, char *comparison, MDFResults *results);
+
+/* Everything the command line asked for, as mdfourier does */
+int MDFRun(MDFEngine *engine);
+
+#endif
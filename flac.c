@@ -42,15 +42,28 @@
 #include <stdlib.h>
 #include "flac.h"
 #include "log.h"
+#include "threads.h"
 #include "FLAC/stream_decoder.h"
 
 #include <ctype.h>
+#if !defined (WIN32)
+#include <sys/mman.h>
+#endif
 
 extern char *getFilenameExtension(char *filename);
 extern int getExtensionLength(char *filename);
 static FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data);
 static void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data);
 static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
+static FLAC__StreamDecoderWriteStatus probe_write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data);
+static void probe_metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data);
+static void probe_error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
+static FLAC__StreamDecoderWriteStatus segment_write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data);
+static void segment_error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
+static FLAC__StreamDecoderWriteStatus lazy_write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data);
+static void lazy_error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
+static void FillStreamInfo(AudioSignal *Signal, const FLAC__StreamMetadata_StreamInfo *info);
+static void StoreFLACFrame(int16_t *samples16, const FLAC__int32 * const buffer[], size_t first, size_t count, int channels);
 
 char *strtoupper(char *str)
 {
@@ -111,15 +124,39 @@ int FillRIFFHeader(wav_hdr *header)
 
 int FLACtoSignal(char *input, AudioSignal *Signal, parameters *config)
 {
-	FLAC__bool ok = true;
-	FLAC__StreamDecoder *decoder = 0;
-	FLAC__StreamDecoderInitStatus init_status;
-
 	if(!Signal) {
 		logmsg("ERROR: opening empty Data Sturcture\n");
 		return 0;
 	}
 
+	if(config->boundedMemory)
+	{
+		int lazy = 0;
+
+		lazy = FLACtoSignalLazy(input, Signal, config);
+		if(lazy != FLAC_DECODE_SEQUENTIAL)
+			return lazy;
+	}
+
+	if(config->threads > 1)
+	{
+		int segmented = 0;
+
+		segmented = FLACtoSignalSegmented(input, Signal, config);
+		if(segmented != FLAC_DECODE_SEQUENTIAL)
+			return segmented;
+	}
+	return(FLACtoSignalSequential(input, Signal, config));
+}
+
+int FLACtoSignalSequential(char *input, AudioSignal *Signal, parameters *config)
+{
+	FLAC__bool ok = true;
+	FLAC__StreamDecoder *decoder = 0;
+	FLAC__StreamDecoderInitStatus init_status;
+
+	Signal->Samples = NULL;
+	Signal->samplesPosFLAC = 0;
 	if((decoder = FLAC__stream_decoder_new()) == NULL) {
 		logmsg("ERROR: allocating decoder\n");
 		return 0;
@@ -166,12 +203,498 @@ int FLACtoSignal(char *input, AudioSignal *Signal, parameters *config)
 	return ok ? 1 : 0;
 }
 
+/*
+	Splits the stream in one segment per thread, each one with its own
+	decoder that seeks to its first sample and writes straight into its
+	region of Signal->Samples. Returns FLAC_DECODE_SEQUENTIAL when the
+	sequential decoder should handle the file instead.
+*/
+int FLACtoSignalSegmented(char *input, AudioSignal *Signal, parameters *config)
+{
+	FLACProbe	probe;
+	FLACSegment	*segments = NULL;
+	long int	segmentCount = 0, minSegment = 0, decoded = 0;
+	int			failed = 0, errors = 0;
+
+	memset(&probe, 0, sizeof(FLACProbe));
+	probe.Signal = Signal;
+	if(!ReadFLACStreamHeader(input, &probe))
+	{
+		if(probe.seekPoints)
+			free(probe.seekPoints);
+		return FLAC_DECODE_SEQUENTIAL;
+	}
+
+	// Anything unexpected is reported by the sequential decoder
+	if(Signal->header.fmt.bitsPerSample != 16 ||
+		(Signal->header.fmt.NumOfChan != 2 && Signal->header.fmt.NumOfChan != 1))
+	{
+		if(probe.seekPoints)
+			free(probe.seekPoints);
+		return FLAC_DECODE_SEQUENTIAL;
+	}
+
+	segmentCount = config->threads;
+	minSegment = (long int)Signal->header.fmt.SamplesPerSec*FLAC_MIN_SEGMENT_SECONDS;
+	if(minSegment > 0 && probe.totalSamples/minSegment < segmentCount)
+		segmentCount = probe.totalSamples/minSegment;
+	if(segmentCount < 2)
+	{
+		if(probe.seekPoints)
+			free(probe.seekPoints);
+		return FLAC_DECODE_SEQUENTIAL;
+	}
+
+	segments = (FLACSegment*)malloc(sizeof(FLACSegment)*segmentCount);
+	if(!segments)
+	{
+		logmsg("\tERROR: FLAC segments malloc failed!\n");
+		if(probe.seekPoints)
+			free(probe.seekPoints);
+		return 0;
+	}
+	memset(segments, 0, sizeof(FLACSegment)*segmentCount);
+	for(long int i = 0; i < segmentCount; i++)
+	{
+		segments[i].Signal = Signal;
+		segments[i].fileName = input;
+	}
+	SplitFLACSegments(segments, segmentCount, &probe);
+	if(probe.seekPoints)
+		free(probe.seekPoints);
+
+	// Every sample is written by exactly one segment, no need to clear it
+	Signal->Samples = (char*)malloc(sizeof(char)*Signal->header.data.DataSize);
+	if(!Signal->Samples)
+	{
+		logmsg("\tERROR: FLAC data chunks malloc failed!\n");
+		free(segments);
+		return 0;
+	}
+
+	if(config->verbose) { logmsg(" - Decoding FLAC in %ld segments%s\n", segmentCount, probe.seekCount ? " at seek points" : ""); }
+	runWorkers(segmentCount, segmentCount, DecodeFLACSegmentJob, segments);
+
+	for(long int i = 0; i < segmentCount; i++)
+	{
+		decoded += segments[i].decoded;
+		if(segments[i].errors)
+		{
+			errors += segments[i].errors;
+			logmsgFileOnly("Got error while decoding FLAC: %s\n", FLAC__StreamDecoderErrorStatusString[segments[i].lastError]);
+		}
+		if(segments[i].failed)
+		{
+			if(config->verbose)
+				logmsg(" - FLAC segment %ld at sample %ld failed: %s\n", i, segments[i].startSample, FLAC__StreamDecoderStateString[segments[i].state]);
+			failed = 1;
+		}
+	}
+	free(segments);
+
+	// Validate against STREAMINFO, the sequential decoder handles short streams
+	if(failed || decoded != probe.totalSamples)
+	{
+		if(config->verbose)
+			logmsg(" - FLAC segments decoded %ld of %ld samples, decoding sequentially\n", decoded, probe.totalSamples);
+		free(Signal->Samples);
+		Signal->Samples = NULL;
+		return FLAC_DECODE_SEQUENTIAL;
+	}
+
+	Signal->samplesPosFLAC = Signal->header.data.DataSize;
+	Signal->errorFLAC += errors;
+
+	if(!FillRIFFHeader(&Signal->header))
+		return 0;
+
+	if(Signal->errorFLAC)
+		return 0;
+	return 1;
+}
+
+int ReadFLACStreamHeader(char *input, FLACProbe *probe)
+{
+	FLAC__bool ok = true;
+	FLAC__StreamDecoder *decoder = 0;
+
+	if((decoder = FLAC__stream_decoder_new()) == NULL)
+		return 0;
+
+	(void)FLAC__stream_decoder_set_metadata_respond(decoder, FLAC__METADATA_TYPE_SEEKTABLE);
+	if(FLAC__stream_decoder_init_file(decoder, input, probe_write_callback, probe_metadata_callback, probe_error_callback, /*client_data=*/probe) != FLAC__STREAM_DECODER_INIT_STATUS_OK)
+		ok = false;
+
+	if(ok)
+		ok = FLAC__stream_decoder_process_until_end_of_metadata(decoder);
+
+	FLAC__stream_decoder_delete(decoder);
+
+	if(!ok || probe->totalSamples <= 0)
+		return 0;
+	return 1;
+}
+
+/*
+	Segments get an even share of the remaining samples, moved to the
+	closest seek point when there is one nearby so the seek lands on a
+	frame boundary and nothing is decoded twice
+*/
+void SplitFLACSegments(FLACSegment *segments, long int count, FLACProbe *probe)
+{
+	long int start = 0;
+
+	for(long int i = 0; i < count; i++)
+	{
+		long int end = 0;
+
+		if(i == count - 1)
+			end = probe->totalSamples;
+		else
+		{
+			long int share = 0, closest = -1;
+
+			share = (probe->totalSamples - start)/(count - i);
+			end = start + share;
+			for(long int p = 0; p < probe->seekCount; p++)
+			{
+				long int point = probe->seekPoints[p];
+
+				if(point <= start || point >= probe->totalSamples)
+					continue;
+				if(closest == -1 || labs(point - end) < labs(closest - end))
+					closest = point;
+			}
+			if(closest != -1 && labs(closest - end) < share/4)
+				end = closest;
+		}
+
+		segments[i].startSample = start;
+		segments[i].endSample = end;
+		start = end;
+	}
+}
+
+int DecodeFLACSegmentJob(long int item, int thread, void *data)
+{
+	FLACSegment *segment = NULL;
+	FLAC__StreamDecoder *decoder = 0;
+	long int length = 0;
+
+	(void)thread;
+	segment = ((FLACSegment*)data) + item;
+	length = segment->endSample - segment->startSample;
+	if(length <= 0)
+		return 1;
+
+	if((decoder = FLAC__stream_decoder_new()) == NULL) {
+		segment->failed = 1;
+		return 0;
+	}
+
+	// MD5 can't be checked on a partial stream
+	if(FLAC__stream_decoder_init_file(decoder, segment->fileName, segment_write_callback, NULL, segment_error_callback, /*client_data=*/segment) != FLAC__STREAM_DECODER_INIT_STATUS_OK)
+		segment->failed = 1;
+
+	// The frame holding startSample is sent to the write callback by the seek
+	if(!segment->failed && !FLAC__stream_decoder_seek_absolute(decoder, segment->startSample))
+		segment->failed = 1;
+
+	while(!segment->failed && segment->decoded < length)
+	{
+		if(!FLAC__stream_decoder_process_single(decoder))
+			segment->failed = 1;
+		else if(FLAC__stream_decoder_get_state(decoder) == FLAC__STREAM_DECODER_END_OF_STREAM)
+			break;
+	}
+
+	if(segment->failed)
+		segment->state = FLAC__stream_decoder_get_state(decoder);
+	FLAC__stream_decoder_delete(decoder);
+
+	return(!segment->failed);
+}
+
+/*
+	Only reads the stream header, samples are decoded as they are requested
+	by DecodeFLACRange. The buffer is an anonymous mapping so the parts
+	that are never requested don't take any memory.
+*/
+int FLACtoSignalLazy(char *input, AudioSignal *Signal, parameters *config)
+{
+#if !defined (WIN32)
+	FLACProbe	probe;
+	FLACLazy	*lazy = NULL;
+	char		*map = NULL;
+	size_t		size = 0;
+
+	memset(&probe, 0, sizeof(FLACProbe));
+	probe.Signal = Signal;
+	if(!ReadFLACStreamHeader(input, &probe))
+	{
+		if(probe.seekPoints)
+			free(probe.seekPoints);
+		return FLAC_DECODE_SEQUENTIAL;
+	}
+	if(probe.seekPoints)
+		free(probe.seekPoints);
+
+	// Anything unexpected is reported by the sequential decoder
+	if(Signal->header.fmt.bitsPerSample != 16 ||
+		(Signal->header.fmt.NumOfChan != 2 && Signal->header.fmt.NumOfChan != 1))
+		return FLAC_DECODE_SEQUENTIAL;
+
+	lazy = (FLACLazy*)malloc(sizeof(FLACLazy));
+	if(!lazy)
+	{
+		logmsg("\tERROR: FLAC decoder malloc failed!\n");
+		return 0;
+	}
+	memset(lazy, 0, sizeof(FLACLazy));
+	lazy->totalSamples = probe.totalSamples;
+	lazy->chunkCount = (probe.totalSamples + FLAC_LAZY_CHUNK_SAMPLES - 1)/FLAC_LAZY_CHUNK_SAMPLES;
+	lazy->nextSample = 0;  // the decoder starts at the first frame
+	lazy->decoded = (char*)malloc(sizeof(char)*lazy->chunkCount);
+	lazy->cache = (int16_t*)malloc(sizeof(int16_t)*FLAC_LAZY_CHUNK_SAMPLES*Signal->header.fmt.NumOfChan);
+	if(!lazy->decoded || !lazy->cache)
+	{
+		logmsg("\tERROR: FLAC decoder malloc failed!\n");
+		Signal->lazyFLAC = lazy;
+		ReleaseFLACLazy(Signal);
+		return 0;
+	}
+	memset(lazy->decoded, 0, sizeof(char)*lazy->chunkCount);
+	Signal->lazyFLAC = lazy;
+
+	lazy->decoder = FLAC__stream_decoder_new();
+	if(!lazy->decoder || FLAC__stream_decoder_init_file(lazy->decoder, input, lazy_write_callback, NULL, lazy_error_callback, /*client_data=*/Signal) != FLAC__STREAM_DECODER_INIT_STATUS_OK)
+	{
+		ReleaseFLACLazy(Signal);
+		return FLAC_DECODE_SEQUENTIAL;
+	}
+
+	size = Signal->header.data.DataSize;
+	map = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED)
+	{
+		ReleaseFLACLazy(Signal);
+		return FLAC_DECODE_SEQUENTIAL;
+	}
+	Signal->SamplesMap = map;
+	Signal->SamplesMapSize = size;
+	Signal->Samples = map;
+	Signal->samplesPosFLAC = Signal->header.data.DataSize;
+
+	if(config->verbose) { logmsg(" - Decoding FLAC on demand\n"); }
+	if(!FillRIFFHeader(&Signal->header))
+		return 0;
+	return 1;
+#else
+	return FLAC_DECODE_SEQUENTIAL;
+#endif
+}
+
+/* Decodes the chunks that hold the byte range, if they are not there yet */
+int DecodeFLACRange(AudioSignal *Signal, long int startByte, long int endByte)
+{
+	FLACLazy	*lazy = Signal->lazyFLAC;
+	long int	frameBytes = 0, chunk = 0, last = 0;
+
+	if(!lazy)
+		return 1;
+
+	if(startByte < 0)
+		startByte = 0;
+	if(endByte > Signal->header.data.DataSize)
+		endByte = Signal->header.data.DataSize;
+	if(endByte <= startByte)
+		return 1;
+
+	frameBytes = 2*Signal->header.fmt.NumOfChan;
+	chunk = startByte/frameBytes/FLAC_LAZY_CHUNK_SAMPLES;
+	last = (endByte - 1)/frameBytes/FLAC_LAZY_CHUNK_SAMPLES;
+	while(chunk <= last)
+	{
+		long int runEnd = chunk, endSample = 0;
+
+		if(lazy->decoded[chunk])
+		{
+			chunk++;
+			continue;
+		}
+
+		while(runEnd <= last && !lazy->decoded[runEnd])
+			runEnd++;
+
+		endSample = runEnd*FLAC_LAZY_CHUNK_SAMPLES;
+		if(endSample > lazy->totalSamples)
+			endSample = lazy->totalSamples;
+		if(!DecodeFLACRun(Signal, chunk*FLAC_LAZY_CHUNK_SAMPLES, endSample))
+			return 0;
+
+		memset(lazy->decoded + chunk, 1, sizeof(char)*(runEnd - chunk));
+		lazy->decodedChunks += runEnd - chunk;
+		chunk = runEnd;
+	}
+	return 1;
+}
+
+int DecodeFLACRun(AudioSignal *Signal, long int startSample, long int endSample)
+{
+	FLACLazy	*lazy = Signal->lazyFLAC;
+	long int	frameBytes = 0;
+
+	frameBytes = 2*Signal->header.fmt.NumOfChan;
+	lazy->runStart = startSample;
+	lazy->runEnd = endSample;
+	lazy->written = 0;
+	lazy->errors = 0;
+
+	// The rest of the last frame starts this run, no need to seek
+	if(lazy->cacheEnd > lazy->cacheStart && lazy->cacheStart == startSample)
+	{
+		long int count = 0;
+
+		count = lazy->cacheEnd < endSample ? lazy->cacheEnd - startSample : endSample - startSample;
+		memcpy(Signal->Samples + startSample*frameBytes, lazy->cache, count*frameBytes);
+		lazy->written = count;
+	}
+	lazy->cacheStart = lazy->cacheEnd = 0;
+
+	if(lazy->written < endSample - startSample && lazy->nextSample != startSample + lazy->written)
+	{
+		if(!FLAC__stream_decoder_seek_absolute(lazy->decoder, startSample + lazy->written))
+		{
+			logmsg("\nERROR: (FLAC) Could not seek to sample %ld: %s\n", startSample + lazy->written,
+				FLAC__StreamDecoderStateString[FLAC__stream_decoder_get_state(lazy->decoder)]);
+			Signal->errorFLAC++;
+			return 0;
+		}
+	}
+
+	while(lazy->written < endSample - startSample)
+	{
+		if(!FLAC__stream_decoder_process_single(lazy->decoder) ||
+			FLAC__stream_decoder_get_state(lazy->decoder) == FLAC__STREAM_DECODER_END_OF_STREAM)
+		{
+			logmsg("\nERROR: (FLAC) Decoding stopped at sample %ld: %s\n", startSample + lazy->written,
+				FLAC__StreamDecoderStateString[FLAC__stream_decoder_get_state(lazy->decoder)]);
+			Signal->errorFLAC++;
+			return 0;
+		}
+	}
+
+	if(lazy->errors)
+	{
+		logmsgFileOnly("Got error while decoding FLAC: %s\n", FLAC__StreamDecoderErrorStatusString[lazy->lastError]);
+		logmsg("\nERROR: (FLAC) Invalid data between samples %ld and %ld\n", startSample, endSample);
+		Signal->errorFLAC += lazy->errors;
+		return 0;
+	}
+	return 1;
+}
+
+/* 
+	Narrows a range to be released to the chunks fully inside it, and marks
+	them to be decoded again if they are ever requested
+*/
+void ForgetFLACRange(AudioSignal *Signal, long int *startByte, long int *endByte)
+{
+	FLACLazy	*lazy = Signal->lazyFLAC;
+	long int	chunkBytes = 0, first = 0, last = 0;
+
+	if(!lazy)
+		return;
+
+	chunkBytes = 2*Signal->header.fmt.NumOfChan*FLAC_LAZY_CHUNK_SAMPLES;
+	first = (*startByte + chunkBytes - 1)/chunkBytes;
+	last = *endByte/chunkBytes;
+	if(last <= first)
+	{
+		*endByte = *startByte;
+		return;
+	}
+
+	memset(lazy->decoded + first, 0, sizeof(char)*(last - first));
+	*startByte = first*chunkBytes;
+	*endByte = last*chunkBytes;
+}
+
+/* Chunks decoded again after being released count again */
+double FLACDecodedPercent(AudioSignal *Signal)
+{
+	FLACLazy	*lazy = Signal->lazyFLAC;
+
+	if(!lazy || !lazy->chunkCount)
+		return 100.0;
+	return(100.0*lazy->decodedChunks/lazy->chunkCount);
+}
+
+void ReleaseFLACLazy(AudioSignal *Signal)
+{
+	FLACLazy	*lazy = Signal->lazyFLAC;
+
+	if(!lazy)
+		return;
+
+	if(lazy->decoder)
+		FLAC__stream_decoder_delete(lazy->decoder);
+	if(lazy->decoded)
+		free(lazy->decoded);
+	if(lazy->cache)
+		free(lazy->cache);
+	free(lazy);
+	Signal->lazyFLAC = NULL;
+}
+
+void FillStreamInfo(AudioSignal *Signal, const FLAC__StreamMetadata_StreamInfo *info)
+{
+	long int total_samples = 0;
+	unsigned sample_rate = 0;
+	unsigned channels = 0;
+	unsigned bps = 0;
+
+	total_samples = info->total_samples;
+	sample_rate = info->sample_rate;
+	channels = info->channels;
+	bps = info->bits_per_sample;
+
+	Signal->header.fmt.AudioFormat = WAVE_FORMAT_PCM;
+	Signal->header.fmt.NumOfChan = channels;
+	Signal->header.fmt.SamplesPerSec = sample_rate;
+	Signal->header.fmt.bytesPerSec = sample_rate * channels * (bps/8);
+	Signal->header.fmt.blockAlign = (FLAC__uint16)(channels * (bps/8));
+	Signal->header.fmt.bitsPerSample = bps;
+	Signal->header.data.DataSize = (FLAC__uint32)(total_samples * channels * (bps/8));
+	Signal->SamplesStart = 0;
+	Signal->samplesPosFLAC = 0;
+}
+
+void StoreFLACFrame(int16_t *samples16, const FLAC__int32 * const buffer[], size_t first, size_t count, int channels)
+{
+	size_t i;
+
+	if(channels == 2)
+	{
+		const FLAC__int32 *left = buffer[0] + first;
+		const FLAC__int32 *right = buffer[1] + first;
+
+		for(i = 0; i < count; i++)
+		{
+			samples16[2*i] = (FLAC__int16)left[i];
+			samples16[2*i+1] = (FLAC__int16)right[i];
+		}
+		return;
+	}
+
+	for(i = 0; i < count; i++)
+		samples16[i] = (FLAC__int16)buffer[0][first+i];
+}
+
 FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
 {
 	AudioSignal *Signal = (AudioSignal*)client_data;
 	int16_t *samples16 = NULL;
-	long int pos = 0;
-	size_t i;
 
 	(void)decoder;
 
@@ -219,13 +742,8 @@ FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder
 
 	/* save decoded PCM samples */
 	samples16 = (int16_t*)(Signal->Samples + Signal->samplesPosFLAC);
-	for(i = 0; i < frame->header.blocksize; i++)
-	{
-		samples16[pos++] = (FLAC__int16)buffer[0][i];
-		if(Signal->header.fmt.NumOfChan == 2)
-			samples16[pos++] = (FLAC__int16)buffer[1][i];
-	}
-	Signal->samplesPosFLAC += pos*2;
+	StoreFLACFrame(samples16, buffer, 0, frame->header.blocksize, Signal->header.fmt.NumOfChan);
+	Signal->samplesPosFLAC += frame->header.blocksize*Signal->header.fmt.NumOfChan*2;
 
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
@@ -237,27 +755,7 @@ void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMet
 	(void)decoder;
 
 	if(metadata->type == FLAC__METADATA_TYPE_STREAMINFO)
-	{
-		long int total_samples = 0;
-		unsigned sample_rate = 0;
-		unsigned channels = 0;
-		unsigned bps = 0;
-
-		total_samples = metadata->data.stream_info.total_samples;
-		sample_rate = metadata->data.stream_info.sample_rate;
-		channels = metadata->data.stream_info.channels;
-		bps = metadata->data.stream_info.bits_per_sample;
-
-		Signal->header.fmt.AudioFormat = WAVE_FORMAT_PCM;
-		Signal->header.fmt.NumOfChan = channels;
-		Signal->header.fmt.SamplesPerSec = sample_rate;
-		Signal->header.fmt.bytesPerSec = sample_rate * channels * (bps/8);
-		Signal->header.fmt.blockAlign = (FLAC__uint16)(channels * (bps/8));
-		Signal->header.fmt.bitsPerSample = bps;
-		Signal->header.data.DataSize = (FLAC__uint32)(total_samples * channels * (bps/8));
-		Signal->SamplesStart = 0;
-		Signal->samplesPosFLAC = 0;
-	}
+		FillStreamInfo(Signal, &metadata->data.stream_info);
 }
 
 void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
@@ -270,3 +768,148 @@ void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderError
 	if(Signal)
 		Signal->errorFLAC ++;
 }
+
+FLAC__StreamDecoderWriteStatus probe_write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+	(void)decoder;
+	(void)frame;
+	(void)buffer;
+	(void)client_data;
+
+	// Only the metadata is read while probing
+	return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+}
+
+void probe_metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data)
+{
+	FLACProbe *probe = (FLACProbe*)client_data;
+
+	(void)decoder;
+
+	if(metadata->type == FLAC__METADATA_TYPE_STREAMINFO)
+	{
+		FillStreamInfo(probe->Signal, &metadata->data.stream_info);
+		probe->totalSamples = metadata->data.stream_info.total_samples;
+	}
+
+	if(metadata->type == FLAC__METADATA_TYPE_SEEKTABLE && !probe->seekPoints)
+	{
+		const FLAC__StreamMetadata_SeekTable *table = &metadata->data.seek_table;
+
+		if(!table->num_points)
+			return;
+		probe->seekPoints = (long int*)malloc(sizeof(long int)*table->num_points);
+		if(!probe->seekPoints)
+			return;
+		for(unsigned p = 0; p < table->num_points; p++)
+		{
+			if(table->points[p].sample_number == FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER)
+				continue;
+			probe->seekPoints[probe->seekCount++] = table->points[p].sample_number;
+		}
+	}
+}
+
+void probe_error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+	(void)decoder;
+	(void)status;
+	(void)client_data;
+}
+
+FLAC__StreamDecoderWriteStatus segment_write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+	FLACSegment *segment = (FLACSegment*)client_data;
+	AudioSignal *Signal = NULL;
+	long int frameStart = 0, first = 0, last = 0;
+	int channels = 0;
+
+	(void)decoder;
+
+	Signal = segment->Signal;
+	channels = Signal->header.fmt.NumOfChan;
+	if(frame->header.channels != (unsigned)channels || buffer[0] == NULL || (channels == 2 && buffer[1] == NULL))
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
+	// Only the part of the frame that belongs to this segment is stored
+	frameStart = frame->header.number.sample_number;
+	first = frameStart > segment->startSample ? frameStart : segment->startSample;
+	last = frameStart + frame->header.blocksize;
+	if(last > segment->endSample)
+		last = segment->endSample;
+
+	// Frames must follow each other with no gaps
+	if(first != segment->startSample + segment->decoded)
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
+	if(last > first)
+	{
+		StoreFLACFrame((int16_t*)Signal->Samples + first*channels, buffer, first - frameStart, last - first, channels);
+		segment->decoded += last - first;
+	}
+	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+void segment_error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+	FLACSegment *segment = (FLACSegment*)client_data;
+
+	(void)decoder;
+
+	segment->errors ++;
+	segment->lastError = status;
+}
+
+FLAC__StreamDecoderWriteStatus lazy_write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+	AudioSignal *Signal = (AudioSignal*)client_data;
+	FLACLazy *lazy = NULL;
+	long int frameStart = 0, frameEnd = 0, first = 0, last = 0;
+	int channels = 0;
+
+	(void)decoder;
+
+	lazy = Signal->lazyFLAC;
+	channels = Signal->header.fmt.NumOfChan;
+	if(frame->header.channels != (unsigned)channels || buffer[0] == NULL || (channels == 2 && buffer[1] == NULL))
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
+	frameStart = frame->header.number.sample_number;
+	frameEnd = frameStart + frame->header.blocksize;
+	lazy->nextSample = frameEnd;
+
+	// Frames must follow each other with no gaps
+	first = lazy->runStart + lazy->written;
+	if(frameStart > first)
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
+	last = frameEnd < lazy->runEnd ? frameEnd : lazy->runEnd;
+	if(last > first)
+	{
+		StoreFLACFrame((int16_t*)Signal->Samples + first*channels, buffer, first - frameStart, last - first, channels);
+		lazy->written += last - first;
+	}
+
+	// Keep what goes beyond the run for the next one
+	if(frameEnd > lazy->runEnd)
+	{
+		first = frameStart > lazy->runEnd ? frameStart : lazy->runEnd;
+		StoreFLACFrame(lazy->cache, buffer, first - frameStart, frameEnd - first, channels);
+		lazy->cacheStart = first;
+		lazy->cacheEnd = frameEnd;
+	}
+	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+void lazy_error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+	AudioSignal *Signal = (AudioSignal*)client_data;
+
+	(void)decoder;
+
+	if(Signal->lazyFLAC)
+	{
+		Signal->lazyFLAC->errors ++;
+		Signal->lazyFLAC->lastError = status;
+	}
+}
@@ -31,8 +31,67 @@
 
 #include "mdfourier.h"
 
+#define FLAC_MIN_SEGMENT_SECONDS	5
+#define FLAC_DECODE_SEQUENTIAL		-1
+/* Also the frame cache size, FLAC blocks are at most 65535 samples */
+#define FLAC_LAZY_CHUNK_SAMPLES		65536
+
+/* Stream header pass, collects STREAMINFO and the usable seek points */
+typedef struct flac_probe_st {
+	AudioSignal	*Signal;
+	long int	*seekPoints;
+	long int	seekCount;
+	long int	totalSamples;
+} FLACProbe;
+
+/* Each segment decodes [startSample, endSample) into Signal->Samples */
+typedef struct flac_segment_st {
+	AudioSignal	*Signal;
+	char		*fileName;
+	long int	startSample;
+	long int	endSample;
+	long int	decoded;
+	int			errors;
+	int			lastError;
+	int			state;
+	int			failed;
+} FLACSegment;
+
+/*
+	On demand decoding for bounded memory mode. Chunks are decoded the
+	first time they are requested and the tail of the last frame is kept,
+	so requests that follow each other continue without a seek.
+*/
+typedef struct flac_lazy_st {
+	void		*decoder;
+	long int	totalSamples;
+	long int	chunkCount;
+	long int	decodedChunks;
+	char		*decoded;
+	long int	nextSample;
+	long int	runStart;
+	long int	runEnd;
+	long int	written;
+	int16_t		*cache;
+	long int	cacheStart;
+	long int	cacheEnd;
+	int			errors;
+	int			lastError;
+} FLACLazy;
+
 int IsFlac(char *name);
 void renameFLAC(char *flac, char *wav, char *path);
 int FLACtoSignal(char *input, AudioSignal *Signal, parameters *config);
+int FLACtoSignalSequential(char *input, AudioSignal *Signal, parameters *config);
+int FLACtoSignalSegmented(char *input, AudioSignal *Signal, parameters *config);
+int ReadFLACStreamHeader(char *input, FLACProbe *probe);
+void SplitFLACSegments(FLACSegment *segments, long int count, FLACProbe *probe);
+int DecodeFLACSegmentJob(long int item, int thread, void *data);
+int FLACtoSignalLazy(char *input, AudioSignal *Signal, parameters *config);
+int DecodeFLACRange(AudioSignal *Signal, long int startByte, long int endByte);
+int DecodeFLACRun(AudioSignal *Signal, long int startSample, long int endSample);
+void ForgetFLACRange(AudioSignal *Signal, long int *startByte, long int *endByte);
+double FLACDecodedPercent(AudioSignal *Signal);
+void ReleaseFLACLazy(AudioSignal *Signal);
 
 #endif
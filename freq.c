@@ -26,11 +26,15 @@
  * 
  */
 
+#include <pthread.h>
 #include "freq.h"
 #include "log.h"
 #include "cline.h"
+#include "plans.h"
 #include "plot.h"
 #include "float.h"
+#include "loadfile.h"
+#include "flac.h"
 
 #define SORT_NAME FFT_Frequency_Magnitude
 #define SORT_TYPE Frequency
@@ -305,6 +309,120 @@ AudioSignal *CreateAudioSignal(parameters *config)
 	return Signal;
 }
 
+int CloneBlockSamples(BlockSamples *dest, BlockSamples *src)
+{
+	size_t	bytes = 0;
+
+	dest->samples = NULL;
+	dest->window_samples = NULL;
+	dest->size = src->size;
+	dest->difference = src->difference;
+
+	bytes = sizeof(int16_t)*(src->size+1);
+	if(src->samples)
+	{
+		dest->samples = (int16_t*)malloc(bytes);
+		if(!dest->samples)
+			return 0;
+		memcpy(dest->samples, src->samples, bytes);
+	}
+	if(src->window_samples)
+	{
+		dest->window_samples = (int16_t*)malloc(bytes);
+		if(!dest->window_samples)
+			return 0;
+		memcpy(dest->window_samples, src->window_samples, bytes);
+	}
+	return 1;
+}
+
+/* Frequencies go into the arrays already allocated in dest, spectrums are not kept */
+int CloneAudioBlock(AudioBlocks *dest, AudioBlocks *src, parameters *config)
+{
+	Frequency	*freq = NULL, *freqRight = NULL;
+
+	if((src->freq != NULL) != (dest->freq != NULL) ||
+		(src->freqRight != NULL) != (dest->freqRight != NULL))
+		return 0;
+
+	freq = dest->freq;
+	freqRight = dest->freqRight;
+	*dest = *src;
+	dest->freq = freq;
+	dest->freqRight = freqRight;
+	dest->fftwValues.spectrum = NULL;
+	dest->fftwValues.spectrumFloat = NULL;
+	dest->fftwValuesRight.spectrum = NULL;
+	dest->fftwValuesRight.spectrumFloat = NULL;
+	memset(&dest->audio, 0, sizeof(BlockSamples));
+	memset(&dest->audioRight, 0, sizeof(BlockSamples));
+	dest->internalSync = NULL;
+	dest->internalSyncCount = 0;
+
+	if(freq)
+		memcpy(freq, src->freq, sizeof(Frequency)*config->MaxFreq);
+	if(freqRight)
+		memcpy(freqRight, src->freqRight, sizeof(Frequency)*config->MaxFreq);
+
+	if(!CloneBlockSamples(&dest->audio, &src->audio))
+		return 0;
+	if(!CloneBlockSamples(&dest->audioRight, &src->audioRight))
+		return 0;
+
+	if(src->internalSync && src->internalSyncCount > 0)
+	{
+		if(!initInternalSync(dest, src->internalSyncCount))
+			return 0;
+		for(int i = 0; i < src->internalSyncCount; i++)
+		{
+			if(!CloneBlockSamples(&dest->internalSync[i], &src->internalSync[i]))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/* 
+	Copy of a processed signal, so it can be normalized against another
+	signal while the original stays as it was. PCM samples are not copied.
+*/
+AudioSignal *CloneAudioSignal(AudioSignal *Signal, parameters *config)
+{
+	AudioSignal	*Clone = NULL;
+	AudioBlocks	*blocks = NULL, clkFrequencies;
+
+	Clone = CreateAudioSignal(config);
+	if(!Clone)
+		return NULL;
+
+	blocks = Clone->Blocks;
+	clkFrequencies = Clone->clkFrequencies;
+	*Clone = *Signal;
+	Clone->Blocks = blocks;
+	Clone->clkFrequencies = clkFrequencies;
+	Clone->Samples = NULL;
+	Clone->SamplesMap = NULL;
+	Clone->SamplesMapSize = 0;
+	Clone->lazyFLAC = NULL;
+
+	if(config->clkMeasure && !CloneAudioBlock(&Clone->clkFrequencies, &Signal->clkFrequencies, config))
+	{
+		ReleaseAudio(Clone, config);
+		free(Clone);
+		return NULL;
+	}
+	for(int n = 0; n < config->types.totalBlocks; n++)
+	{
+		if(!CloneAudioBlock(&Clone->Blocks[n], &Signal->Blocks[n], config))
+		{
+			ReleaseAudio(Clone, config);
+			free(Clone);
+			return NULL;
+		}
+	}
+	return Clone;
+}
+
 void CleanFrequency(Frequency *freq)
 {
 	if(!freq)
@@ -314,6 +432,7 @@ void CleanFrequency(Frequency *freq)
 	freq->magnitude = 0;
 	freq->amplitude = NO_AMPLITUDE;
 	freq->phase = 0;
+	freq->bin = 0;
 	freq->matched = 0;
 }
 
@@ -344,6 +463,7 @@ void InitAudio(AudioSignal *Signal, parameters *config)
 			CleanFrequenciesInBlock(&Signal->Blocks[n], config);
 			
 			Signal->Blocks[n].fftwValues.spectrum = NULL;
+			Signal->Blocks[n].fftwValues.spectrumFloat = NULL;
 			Signal->Blocks[n].fftwValues.size = 0;
 			Signal->Blocks[n].audio.samples = NULL;
 			Signal->Blocks[n].audio.window_samples = NULL;
@@ -351,6 +471,7 @@ void InitAudio(AudioSignal *Signal, parameters *config)
 			Signal->Blocks[n].audio.difference = 0;
 
 			Signal->Blocks[n].fftwValuesRight.spectrum = NULL;
+			Signal->Blocks[n].fftwValuesRight.spectrumFloat = NULL;
 			Signal->Blocks[n].fftwValuesRight.size = 0;
 			Signal->Blocks[n].audioRight.samples = NULL;
 			Signal->Blocks[n].audioRight.window_samples = NULL;
@@ -378,6 +499,9 @@ void InitAudio(AudioSignal *Signal, parameters *config)
 	Signal->floorAmplitude = 0.0;	
 
 	Signal->Samples = NULL;
+	Signal->SamplesMap = NULL;
+	Signal->SamplesMapSize = 0;
+	Signal->lazyFLAC = NULL;
 	Signal->framerate = 0.0;
 
 	Signal->startOffset = 0;
@@ -400,6 +524,10 @@ void InitAudio(AudioSignal *Signal, parameters *config)
 	Signal->endHz = config->endHz;
 
 	Signal->balance = 0;
+	Signal->balanceChannel = CHANNEL_NONE;
+	Signal->balanceRatio = 0;
+	Signal->balancePos = 0;
+	Signal->normalizeRatio = 0;
 	memset(&Signal->clkFrequencies, 0, sizeof(AudioBlocks));
 	Signal->EstimatedSR = 0;
 	Signal->originalSR = 0;
@@ -464,6 +592,18 @@ void ReleaseFFTW(AudioBlocks * AudioArray)
 		free(AudioArray->fftwValuesRight.spectrum);
 		AudioArray->fftwValuesRight.spectrum = NULL;
 	}
+
+	if(AudioArray->fftwValues.spectrumFloat)
+	{
+		free(AudioArray->fftwValues.spectrumFloat);
+		AudioArray->fftwValues.spectrumFloat = NULL;
+	}
+
+	if(AudioArray->fftwValuesRight.spectrumFloat)
+	{
+		free(AudioArray->fftwValuesRight.spectrumFloat);
+		AudioArray->fftwValuesRight.spectrumFloat = NULL;
+	}
 }
 
 void ReleaseSamples(AudioBlocks * AudioArray)
@@ -554,6 +694,13 @@ void ReleasePCM(AudioSignal *Signal)
 	if(!Signal)
 		return;
 
+	ReleaseFLACLazy(Signal);
+	if(Signal->SamplesMap)
+	{
+		UnmapWAVFile(Signal);
+		return;
+	}
+
 	if(Signal->Samples)
 	{
 		free(Signal->Samples);
@@ -591,23 +738,7 @@ void ReleaseAudioBlockStructure(parameters *config)
 		config->types.typeCount = 0;
 	}
 
-	if(config->model_plan)
-	{
-		fftw_export_wisdom_to_filename("wisdom.fftw");
-
-		fftw_destroy_plan(config->model_plan);
-		config->model_plan = NULL;
-	}
-	if(config->reverse_plan)
-	{
-		fftw_destroy_plan(config->reverse_plan);
-		config->reverse_plan = NULL;
-	}
-	if(config->sync_plan)
-	{
-		fftw_destroy_plan(config->sync_plan);
-		config->sync_plan = NULL;
-	}
+	freePlans(&config->plans);
 }
 
 int CalculateTimeDurations(AudioSignal *Signal, parameters *config)
@@ -2309,6 +2440,26 @@ inline double CalculatePhase(fftw_complex value)
 	return phase;
 }
 
+inline double CalculateMagnitudeFloat(fftwf_complex value, long int size)
+{
+	float r1 = 0;
+	float i1 = 0;
+
+	r1 = crealf(value);
+	i1 = cimagf(value);
+	return(sqrtf(r1*r1 + i1*i1)/(float)size);
+}
+
+inline double CalculatePhaseFloat(fftwf_complex value)
+{
+	float r1 = 0;
+	float i1 = 0;
+
+	r1 = crealf(value);
+	i1 = cimagf(value);
+	return(atan2f(i1, r1)*180/M_PI);
+}
+
 inline double CalculateAmplitude(double magnitude, double MaxMagnitude)
 {
 	double amplitude = 0;
@@ -2360,10 +2511,265 @@ int FillFrequencyStructures(AudioSignal *Signal, AudioBlocks *AudioArray, parame
 	return 1;
 }
 
+/*
+	Ranking used to pick the top frequencies: higher magnitude first and
+	the lower bin on ties, the same order the stable tim_sort produced
+*/
+inline int IsRankedLower(Frequency *f_array, long int a, long int b)
+{
+	if(f_array[a].magnitude != f_array[b].magnitude)
+		return(f_array[a].magnitude < f_array[b].magnitude);
+	return(a > b);
+}
+
+void SiftDownRankHeap(Frequency *f_array, long int *heap, long int size, long int pos)
+{
+	while(1)
+	{
+		long int lowest = pos, left = 2*pos+1, right = 2*pos+2, tmp = 0;
+
+		if(left < size && IsRankedLower(f_array, heap[left], heap[lowest]))
+			lowest = left;
+		if(right < size && IsRankedLower(f_array, heap[right], heap[lowest]))
+			lowest = right;
+		if(lowest == pos)
+			return;
+
+		tmp = heap[pos];
+		heap[pos] = heap[lowest];
+		heap[lowest] = tmp;
+		pos = lowest;
+	}
+}
+
+/*
+	Keeps the top amount elements in a heap with the lowest ranked at the
+	root, so only O(count log amount) comparisons are needed instead of
+	sorting every bin. The winners are then popped from last to first.
+*/
+int SelectTopFrequencies(Frequency *f_array, long int count, Frequency *targetFreq, long int amount)
+{
+	long int	*heap = NULL, size = 0;
+
+	if(amount <= 0)
+		return 1;
+
+	heap = (long int*)malloc(sizeof(long int)*amount);
+	if(!heap)
+	{
+		logmsg("ERROR: Not enough memory (heap)\n");
+		return 0;
+	}
+
+	for(long int i = 0; i < count; i++)
+	{
+		if(size < amount)
+		{
+			long int pos = size++;
+
+			heap[pos] = i;
+			while(pos > 0)
+			{
+				long int parent = (pos-1)/2, tmp = 0;
+
+				if(!IsRankedLower(f_array, heap[pos], heap[parent]))
+					break;
+				tmp = heap[pos];
+				heap[pos] = heap[parent];
+				heap[parent] = tmp;
+				pos = parent;
+			}
+		}
+		else if(IsRankedLower(f_array, heap[0], i))
+		{
+			heap[0] = i;
+			SiftDownRankHeap(f_array, heap, size, 0);
+		}
+	}
+
+	while(size)
+	{
+		targetFreq[size-1] = f_array[heap[0]];
+		heap[0] = heap[--size];
+		SiftDownRankHeap(f_array, heap, size, 0);
+	}
+
+	free(heap);
+	return 1;
+}
+
+inline double CalculatePower(fftw_complex value)
+{
+	double r1 = 0;
+	double i1 = 0;
+
+	r1 = creal(value);
+	i1 = cimag(value);
+	return(r1*r1 + i1*i1);
+}
+
+inline double CalculatePowerFloat(fftwf_complex value)
+{
+	float r1 = 0;
+	float i1 = 0;
+
+	r1 = crealf(value);
+	i1 = cimagf(value);
+	return(r1*r1 + i1*i1);
+}
+
+/* The double spectrum wins when both are there, with -4 v the float one is only validated */
+inline double SpectrumPower(FFTWSpectrum *fftw, long int bin)
+{
+	if(fftw->spectrum)
+		return(CalculatePower(fftw->spectrum[bin]));
+	return(CalculatePowerFloat(fftw->spectrumFloat[bin]));
+}
+
+inline double SpectrumMagnitude(FFTWSpectrum *fftw, long int bin)
+{
+	if(fftw->spectrum)
+		return(CalculateMagnitude(fftw->spectrum[bin], fftw->size));
+	return(CalculateMagnitudeFloat(fftw->spectrumFloat[bin], fftw->size));
+}
+
+inline double SpectrumPhase(FFTWSpectrum *fftw, long int bin)
+{
+	if(fftw->spectrum)
+		return(CalculatePhase(fftw->spectrum[bin]));
+	return(CalculatePhaseFloat(fftw->spectrumFloat[bin]));
+}
+
+#define RANK_RELAX	1e-12
+
+/* Same ranking as IsRankedLower, using the squared magnitude from the spectrum */
+inline int IsBinRankedLower(FFTWSpectrum *fftw, long int startBin, long int a, long int b)
+{
+	double powerA = 0, powerB = 0;
+
+	powerA = SpectrumPower(fftw, startBin+a);
+	powerB = SpectrumPower(fftw, startBin+b);
+	if(powerA != powerB)
+		return(powerA < powerB);
+	return(a > b);
+}
+
+void SiftDownBinHeap(FFTWSpectrum *fftw, long int startBin, long int *heap, long int size, long int pos)
+{
+	while(1)
+	{
+		long int lowest = pos, left = 2*pos+1, right = 2*pos+2, tmp = 0;
+
+		if(left < size && IsBinRankedLower(fftw, startBin, heap[left], heap[lowest]))
+			lowest = left;
+		if(right < size && IsBinRankedLower(fftw, startBin, heap[right], heap[lowest]))
+			lowest = right;
+		if(lowest == pos)
+			return;
+
+		tmp = heap[pos];
+		heap[pos] = heap[lowest];
+		heap[lowest] = tmp;
+		pos = lowest;
+	}
+}
+
+/*
+	First stage of the extraction, finds the weakest bin among the top
+	amount ones by squared magnitude, without any sqrt or atan2. Bins
+	are counted from startBin, in either precision of the spectrum.
+	Returns -1 if every bin has to be considered.
+*/
+long int FindTopBinsThreshold(FFTWSpectrum *fftw, long int startBin, long int count, long int amount)
+{
+	long int	*heap = NULL, size = 0, weakest = 0;
+
+	if(amount <= 0 || amount >= count)
+		return -1;
+
+	heap = (long int*)malloc(sizeof(long int)*amount);
+	if(!heap)
+		return -1;  // slower but still valid
+
+	for(long int i = 0; i < count; i++)
+	{
+		if(size < amount)
+		{
+			long int pos = size++;
+
+			heap[pos] = i;
+			while(pos > 0)
+			{
+				long int parent = (pos-1)/2, tmp = 0;
+
+				if(!IsBinRankedLower(fftw, startBin, heap[pos], heap[parent]))
+					break;
+				tmp = heap[pos];
+				heap[pos] = heap[parent];
+				heap[parent] = tmp;
+				pos = parent;
+			}
+		}
+		else if(IsBinRankedLower(fftw, startBin, heap[0], i))
+		{
+			heap[0] = i;
+			SiftDownBinHeap(fftw, startBin, heap, size, 0);
+		}
+	}
+
+	weakest = heap[0];
+	free(heap);
+	return weakest;
+}
+
+static pthread_mutex_t floatValidationLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* -4 v, how far the float spectrum is from the double one at the frequencies that were kept */
+void ValidateFloatSpectrum(FFTWSpectrum *fftw, Frequency *freq, long int amount, parameters *config)
+{
+	double		maxDeviation = 0, level = 0;
+	long int	compared = 0;
+
+	for(long int i = 0; i < amount; i++)
+	{
+		double magnitude = 0, deviation = 0;
+
+		if(!freq[i].hertz || freq[i].magnitude <= 0)
+			break;
+
+		magnitude = CalculateMagnitudeFloat(fftw->spectrumFloat[freq[i].bin], fftw->size);
+		compared++;
+		if(magnitude <= 0)
+			continue;
+
+		deviation = fabs(20*log10(magnitude/freq[i].magnitude));
+		if(deviation > maxDeviation)
+		{
+			maxDeviation = deviation;
+			level = 20*log10(freq[i].magnitude/freq[0].magnitude);
+		}
+	}
+
+	pthread_mutex_lock(&floatValidationLock);
+	config->floatCompared += compared;
+	if(maxDeviation > config->floatMaxDeviation)
+	{
+		config->floatMaxDeviation = maxDeviation;
+		config->floatDeviationLevel = level;
+	}
+	pthread_mutex_unlock(&floatValidationLock);
+}
+
+void ReportFloatValidation(parameters *config)
+{
+	logmsg(" - Single precision FFT: max deviation %g dB over %ld frequencies, %0.1f dB below its block peak\n",
+		config->floatMaxDeviation, config->floatCompared, config->floatDeviationLevel);
+}
+
 int FillFrequencyStructuresInternal(AudioSignal *Signal, AudioBlocks *AudioArray, char channel, parameters *config)
 {
-	long int 		i = 0, startBin= 0, endBin = 0, count = 0, size = 0, amount = 0;
-	double 			boxsize = 0;
+	long int 		i = 0, startBin= 0, endBin = 0, count = 0, size = 0, amount = 0, weakest = -1;
+	double 			boxsize = 0, threshold = 0, thresholdMag = 0;
 	int				nyquistLimit = 0;
 	Frequency		*f_array = NULL, *targetFreq = NULL;
 	FFTWSpectrum	*fftw = NULL;
@@ -2379,7 +2785,7 @@ int FillFrequencyStructuresInternal(AudioSignal *Signal, AudioBlocks *AudioArray
 		targetFreq = AudioArray->freqRight;
 	}
 	size = fftw->size;
-	if(!size || !fftw->spectrum || !targetFreq)
+	if(!size || (!fftw->spectrum && !fftw->spectrumFloat) || !targetFreq)
 	{
 		logmsg("FillFrequencyStructures size == 0\n");
 		return 0;
@@ -2409,38 +2815,68 @@ int FillFrequencyStructuresInternal(AudioSignal *Signal, AudioBlocks *AudioArray
 	logmsgFileOnly("Size: %ld BoxSize: %g StartBin: %ld EndBin %ld\n",
 		 size, boxsize, startBin, endBin);
 	*/
-	f_array = (Frequency*)malloc(sizeof(Frequency)*(endBin-startBin));
+	if(endBin < startBin)
+		endBin = startBin;
+
+	if(config->MaxFreq > endBin-startBin)
+		amount = endBin-startBin;
+	else
+		amount = config->MaxFreq;
+
+	/*
+		Rank by squared magnitude first, then only calculate magnitude and
+		phase for the bins that can make it. Different squared values can
+		round to the same magnitude, so the threshold is relaxed a bit and
+		the final pick is done by magnitude, as before.
+	*/
+	weakest = FindTopBinsThreshold(fftw, startBin, endBin-startBin, amount);
+	if(weakest != -1)
+	{
+		threshold = SpectrumPower(fftw, startBin+weakest)*(1.0 - RANK_RELAX);
+		thresholdMag = SpectrumMagnitude(fftw, startBin+weakest);
+	}
+
+	f_array = (Frequency*)malloc(sizeof(Frequency)*(endBin-startBin > 0 ? endBin-startBin : 1));
 	if(!f_array)
 	{
 		logmsg("ERROR: Not enough memory (f_array)\n");
 		return 0;
 	}
-	memset(f_array, 0, sizeof(Frequency)*(endBin-startBin));
 
 	for(i = startBin; i < endBin; i++)
 	{
+		double magnitude = 0;
+
+		if(weakest != -1 && SpectrumPower(fftw, i) < threshold)
+			continue;
+
+		magnitude = SpectrumMagnitude(fftw, i);
+		if(magnitude < thresholdMag)
+			continue;
+
 		f_array[count].hertz = CalculateFrequency(i, boxsize);
-		f_array[count].magnitude = CalculateMagnitude(fftw->spectrum[i], size);
+		f_array[count].magnitude = magnitude;
 		f_array[count].amplitude = NO_AMPLITUDE;
-		f_array[count].phase = CalculatePhase(fftw->spectrum[i]);
+		f_array[count].phase = SpectrumPhase(fftw, i);
+		f_array[count].bin = i;
 		f_array[count].matched = 0;
 		count++;
 	}
 
-	if(config->MaxFreq > count)
-		amount = count;
-	else
-		amount = config->MaxFreq;
-
-	// Sort the array by top magnitudes
-	FFT_Frequency_Magnitude_tim_sort(f_array, count);
-	// Only copy Top amount frequencies
-	memcpy(targetFreq, f_array, sizeof(Frequency)*amount);
+	// Only copy Top amount frequencies, sorted by magnitude
+	if(!SelectTopFrequencies(f_array, count, targetFreq, amount))
+	{
+		free(f_array);
+		return 0;
+	}
 
 	// release temporal storage
 	free(f_array);
 	f_array = NULL;
 
+	if(fftw->spectrum && fftw->spectrumFloat)
+		ValidateFloatSpectrum(fftw, targetFreq, amount, config);
+
 	return 1;
 }
 
@@ -2684,6 +3120,12 @@ inline double GetDecimalValues(double value)
 	return value;
 }
 
+// Reference and Comparison can be processed at the same time, both mark the same flags
+void SetRoleFlag(int *flag, int role)
+{
+	__sync_fetch_and_or(flag, role);
+}
+
 long int GetZeroPadValues(long int *monoSignalSize, double *seconds, long int samplerate)
 {
 	long int zeropadding = 0;
@@ -2772,7 +3214,7 @@ double CalculateFrameRateAndCheckSamplerate(AudioSignal *Signal, parameters *con
 		else
 			config->ComCentsDifferenceSR = centsDifferenceSR;
 		
-		config->SRNoMatch |= Signal->role;
+		SetRoleFlag(&config->SRNoMatch, Signal->role);
 	}
 
 	return framerate;
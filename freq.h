@@ -83,6 +83,9 @@ void CheckSilenceOverride(parameters *config);
 int ConvertAudioTypeForProcessing(int type, parameters *config);
 
 AudioSignal *CreateAudioSignal(parameters *config);
+AudioSignal *CloneAudioSignal(AudioSignal *Signal, parameters *config);
+int CloneAudioBlock(AudioBlocks *dest, AudioBlocks *src, parameters *config);
+int CloneBlockSamples(BlockSamples *dest, BlockSamples *src);
 void CleanFrequency(Frequency *freq);
 void CleanFrequenciesInBlock(AudioBlocks * AudioArray, parameters *config);
 void ReleaseFFTW(AudioBlocks * AudioArray);
@@ -97,6 +100,20 @@ int initInternalSync(AudioBlocks * AudioArray, int size);
 void ReleaseAudio(AudioSignal *Signal, parameters *config);
 void CleanMatched(AudioSignal *ReferenceSignal, AudioSignal *TestSignal, parameters *config);
 int FillFrequencyStructures(AudioSignal *Signal, AudioBlocks *AudioArray, parameters *config);
+int IsRankedLower(Frequency *f_array, long int a, long int b);
+void SiftDownRankHeap(Frequency *f_array, long int *heap, long int size, long int pos);
+int SelectTopFrequencies(Frequency *f_array, long int count, Frequency *targetFreq, long int amount);
+void FFT_Frequency_Magnitude_tim_sort(Frequency *dst, const size_t size);
+double CalculatePower(fftw_complex value);
+double CalculatePowerFloat(fftwf_complex value);
+double SpectrumPower(FFTWSpectrum *fftw, long int bin);
+double SpectrumMagnitude(FFTWSpectrum *fftw, long int bin);
+double SpectrumPhase(FFTWSpectrum *fftw, long int bin);
+int IsBinRankedLower(FFTWSpectrum *fftw, long int startBin, long int a, long int b);
+void SiftDownBinHeap(FFTWSpectrum *fftw, long int startBin, long int *heap, long int size, long int pos);
+long int FindTopBinsThreshold(FFTWSpectrum *fftw, long int startBin, long int count, long int amount);
+void ValidateFloatSpectrum(FFTWSpectrum *fftw, Frequency *freq, long int amount, parameters *config);
+void ReportFloatValidation(parameters *config);
 int FillFrequencyStructuresInternal(AudioSignal *Signal, AudioBlocks *AudioArray, char channel, parameters *config);
 void PrintFrequencies(AudioSignal *Signal, parameters *config);
 void PrintFrequenciesWMagnitudes(AudioSignal *Signal, parameters *config);
@@ -136,6 +153,8 @@ int DetectWatermarkIssue(char *msg, parameters *config);
 double CalculateMagnitude(fftw_complex value, long int size);
 double CalculateAmplitude(double magnitude, double MaxMagnitude);
 double CalculatePhase(fftw_complex value);
+double CalculateMagnitudeFloat(fftwf_complex value, long int size);
+double CalculatePhaseFloat(fftwf_complex value);
 double CalculateFrequency(double boxindex, double boxsize);
 double CalculateFrameRate(AudioSignal *Signal, parameters *config);
 double CalculateFrameRateNS(AudioSignal *Signal, double Frames, parameters *config);
@@ -144,6 +163,7 @@ double CalculateScanRate(AudioSignal *Signal);
 double CalculateScanRateOriginalFramerate(AudioSignal *Signal);
 
 double FindFrequencyBinSizeForBlock(AudioSignal *Signal, long int block);
+void SetRoleFlag(int *flag, int role);
 long int GetZeroPadValues(long int *monoSignalSize, double *seconds, long int samplerate);
 void CalcuateFrequencyBrackets(AudioSignal *signal, parameters *config);
 double FindFrequencyBracket(double frequency, size_t size, int AudioChannels, long samplerate, parameters *config);